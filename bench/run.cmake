@@ -0,0 +1,45 @@
+# Runs constexpr-everything over the benchmark corpus and writes its
+# -stats-json summary. Invoked by the benchmark target:
+#
+#   cmake -DTOOL=<constexpr-everything> -DSOURCE_DIR=<bench>
+#         -DBINARY_DIR=<dir> -DLLVM_DIR=<dir> [-DLLVM_SOURCE_DIR=<dir>]
+#         [-DJOBS=N] [-DOUTPUT=<file>] [-DEXTRA_ARGS=<args>] -P run.cmake
+
+foreach(variable TOOL SOURCE_DIR BINARY_DIR LLVM_DIR)
+  if(NOT ${variable})
+    message(FATAL_ERROR "${variable} must be set")
+  endif()
+endforeach()
+if(NOT DEFINED JOBS)
+  set(JOBS 1)
+endif()
+if(NOT OUTPUT)
+  set(OUTPUT ${BINARY_DIR}/benchmark.json)
+endif()
+
+# The corpus is only configured, for its compile commands
+file(MAKE_DIRECTORY ${BINARY_DIR})
+execute_process(
+  COMMAND ${CMAKE_COMMAND} ${SOURCE_DIR} -DLLVM_DIR=${LLVM_DIR}
+          -DLLVM_SOURCE_DIR=${LLVM_SOURCE_DIR}
+  WORKING_DIRECTORY ${BINARY_DIR}
+  RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "can't configure the benchmark corpus")
+endif()
+
+file(STRINGS ${BINARY_DIR}/sources.txt sources)
+separate_arguments(EXTRA_ARGS)
+file(REMOVE ${OUTPUT})
+execute_process(
+  COMMAND ${TOOL} -p ${BINARY_DIR} -j=${JOBS} -stats-json=${OUTPUT}
+          ${EXTRA_ARGS} ${sources}
+  OUTPUT_QUIET ERROR_QUIET
+  RESULT_VARIABLE result)
+if(NOT EXISTS ${OUTPUT})
+  message(FATAL_ERROR "constexpr-everything failed on the corpus (${result})")
+endif()
+
+file(READ ${OUTPUT} summary)
+message(STATUS "benchmark results: ${OUTPUT}")
+message(STATUS "${summary}")
@@ -0,0 +1,71 @@
+// A TU that spends most of its time in the LLVM ADT headers, with a few
+// templates of its own instantiated over them
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+
+template <typename T> T square(T value) { return value * value; }
+
+template <typename T> T sumOfSquares(llvm::ArrayRef<T> values) {
+  T sum = 0;
+  for (const auto &value : values)
+    sum += square(value);
+  return sum;
+}
+
+template <typename Map> unsigned countAbove(const Map &map, unsigned limit) {
+  unsigned count = 0;
+  for (const auto &entry : map)
+    if (entry.second > limit)
+      ++count;
+  return count;
+}
+
+unsigned keywordLength(llvm::StringRef keyword) {
+  return llvm::StringSwitch<unsigned>(keyword)
+      .Case("constexpr", 9)
+      .Case("consteval", 9)
+      .Case("constinit", 9)
+      .Default(0);
+}
+
+int useTemplates() {
+  llvm::SmallVector<int, 8> ints = {1, 2, 3, 4};
+  llvm::SmallVector<long, 8> longs = {5, 6, 7};
+  const int squares = square(7);
+
+  llvm::DenseMap<int, unsigned> dense;
+  llvm::StringMap<unsigned> strings;
+  llvm::MapVector<int, unsigned> ordered;
+  for (int i = 0; i < 16; ++i) {
+    dense[i] = square(i);
+    ordered.insert({i, unsigned(i)});
+  }
+  strings["constexpr"] = keywordLength("constexpr");
+
+  llvm::SetVector<int> set(ints.begin(), ints.end());
+  llvm::SmallPtrSet<const int *, 4> pointers;
+  pointers.insert(&ints.front());
+
+  llvm::SmallString<32> text;
+  (llvm::Twine("n") + llvm::Twine(squares)).toVector(text);
+
+  llvm::APInt wide(128, square<uint64_t>(1u << 20));
+  return sumOfSquares<int>(ints) + int(sumOfSquares<long>(longs)) +
+         int(countAbove(dense, 8) + countAbove(strings, 0) +
+             countAbove(ordered, 4)) +
+         int(set.size() + pointers.size() + text.size()) +
+         int(wide.getActiveBits()) + squares;
+}
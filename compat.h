@@ -0,0 +1,271 @@
+#ifndef CONSTEXPR_EVERYTHING_COMPAT_H
+#define CONSTEXPR_EVERYTHING_COMPAT_H
+
+#include <memory>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/PartialDiagnostic.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Specifiers.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Sema/Sema.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+// ASTContext::getParents is defined with the parent map since LLVM 11
+#if LLVM_VERSION_MAJOR >= 11
+#include "clang/AST/ParentMapContext.h"
+#endif
+
+// The name generator moved from clangIndex to clangAST in LLVM 10
+#if LLVM_VERSION_MAJOR >= 10
+#include "clang/AST/Mangle.h"
+#else
+#include "clang/Index/CodegenNameGenerator.h"
+#endif
+
+/*
+ * compat
+ *
+ * Everything that differs between the supported LLVM releases, from 9 on.
+ * The rest of the tool only uses APIs that are the same in all of them, so a
+ * new release should only need changes here.
+ */
+namespace compat {
+
+#if LLVM_VERSION_MAJOR >= 10
+using SymbolNameGenerator = clang::ASTNameGenerator;
+#else
+using SymbolNameGenerator = clang::index::CodegenNameGenerator;
+#endif
+
+// ASTUnit takes what to capture since LLVM 10
+#if LLVM_VERSION_MAJOR >= 10
+constexpr auto CaptureAllDiagnostics = clang::CaptureDiagsKind::All;
+#else
+constexpr bool CaptureAllDiagnostics = true;
+#endif
+
+// The constexpr specifier kinds became a scoped enum in LLVM 12
+namespace ConstexprKind {
+#if LLVM_VERSION_MAJOR >= 12
+constexpr auto Unspecified = clang::ConstexprSpecKind::Unspecified;
+constexpr auto Constexpr = clang::ConstexprSpecKind::Constexpr;
+#else
+constexpr auto Unspecified = clang::CSK_unspecified;
+constexpr auto Constexpr = clang::CSK_constexpr;
+#endif
+} // namespace ConstexprKind
+
+// C++2a was renamed to C++20 in LLVM 11
+inline bool isCPlusPlus20(const clang::LangOptions &langOpts) {
+#if LLVM_VERSION_MAJOR >= 11
+  return langOpts.CPlusPlus20;
+#else
+  return langOpts.CPlusPlus2a;
+#endif
+}
+
+// isRValue was renamed to isPRValue in LLVM 13, it never meant xvalues
+inline bool isPRValue(const clang::Expr *expr) {
+#if LLVM_VERSION_MAJOR >= 13
+  return expr->isPRValue();
+#else
+  return expr->isRValue();
+#endif
+}
+
+// startswith is deprecated since LLVM 18, which all have starts_with
+inline bool startsWith(llvm::StringRef string, llvm::StringRef prefix) {
+#if LLVM_VERSION_MAJOR >= 18
+  return string.starts_with(prefix);
+#else
+  return string.startswith(prefix);
+#endif
+}
+
+// The bytecode constant interpreter was added in LLVM 10. The evaluator
+// checks the option on every evaluation, so it can be switched at any time.
+constexpr bool HasBytecodeInterpreter = LLVM_VERSION_MAJOR >= 10;
+
+inline void setBytecodeInterpreter(clang::LangOptions &langOpts, bool enable) {
+#if LLVM_VERSION_MAJOR >= 10
+  langOpts.EnableNewConstInterp = enable;
+#endif
+}
+
+// Sema's checks of a function's declaration and body for constexpr, without
+// diagnostics. LLVM 10 merged both into one.
+inline bool checkConstexprFunction(clang::Sema &sema,
+                                   const clang::FunctionDecl *func) {
+#if LLVM_VERSION_MAJOR >= 10
+  return sema.CheckConstexprFunctionDefinition(
+      func, clang::Sema::CheckConstexprKind::CheckValid);
+#else
+  return sema.CheckConstexprFunctionDecl(func) &&
+         sema.CheckConstexprFunctionBody(func, func->getBody());
+#endif
+}
+
+// Sema evaluates the initializers of const integral variables while parsing
+// and keeps the result on the decl. Drop it so the initializer is evaluated
+// again with the functions this run made constexpr.
+inline void forgetEvaluation(const clang::VarDecl *var) {
+  clang::EvaluatedStmt *eval = var->ensureEvaluatedStmt();
+  if (!eval->WasEvaluated || eval->IsEvaluating)
+    return;
+
+  eval->WasEvaluated = false;
+#if LLVM_VERSION_MAJOR >= 12
+  eval->HasConstantInitialization = false;
+  eval->CheckedForICEInit = false;
+  eval->HasICEInit = false;
+#else
+  eval->CheckedICE = false;
+  eval->IsICE = false;
+#endif
+  eval->Evaluated = clang::APValue();
+}
+
+// Whether the initializer is a constant expression, whatever the variable's
+// type. Since LLVM 12 that's a check of its own, which can't follow an
+// earlier evaluation of the value.
+inline bool hasConstantInitializer(
+    const clang::VarDecl *var,
+    llvm::SmallVectorImpl<clang::PartialDiagnosticAt> &notes) {
+#if LLVM_VERSION_MAJOR >= 12
+  forgetEvaluation(var);
+  return var->checkForConstantInitialization(notes);
+#else
+  // Since C++11 an "ICE" here is any initializer that is a constant
+  // expression
+  return var->evaluateValue(notes) && var->isInitICE();
+#endif
+}
+
+// The path a file was resolved to, or the name it was opened with.
+inline llvm::StringRef entryPath(const clang::FileEntry *entry) {
+  llvm::StringRef path = entry->tryGetRealPathName();
+  return path.empty() ? entry->getName() : path;
+}
+
+#if LLVM_VERSION_MAJOR >= 12
+inline llvm::StringRef entryPath(clang::FileEntryRef entry) {
+  llvm::StringRef path = entry.getFileEntry().tryGetRealPathName();
+  return path.empty() ? entry.getName() : path;
+}
+#endif
+
+// The file behind a FileID, empty for buffers that aren't files. With
+// realPath, the path it was resolved to where it's known.
+inline llvm::StringRef fileName(const clang::SourceManager &sm,
+                                clang::FileID id, bool realPath = false) {
+#if LLVM_VERSION_MAJOR >= 12
+  auto entry = sm.getFileEntryRefForID(id);
+  if (!entry)
+    return llvm::StringRef();
+  return realPath ? entryPath(*entry) : entry->getName();
+#else
+  const auto *entry = sm.getFileEntryForID(id);
+  if (!entry)
+    return llvm::StringRef();
+  return realPath ? entryPath(entry) : entry->getName();
+#endif
+}
+
+// Calls callback with the path of every file the SourceManager loaded
+template <typename Callback>
+void forEachLoadedFile(const clang::SourceManager &sm, Callback callback) {
+  for (auto it = sm.fileinfo_begin(); it != sm.fileinfo_end(); ++it)
+    callback(entryPath(it->first));
+}
+
+// The thread pools take a strategy since LLVM 11, 0 jobs is all cores
+inline auto threadPoolStrategy(unsigned jobs) {
+#if LLVM_VERSION_MAJOR >= 11
+  return llvm::hardware_concurrency(jobs);
+#else
+  return jobs == 0 ? llvm::hardware_concurrency() : jobs;
+#endif
+}
+
+// The top-level subcommand, for options that are also shared with
+// subcommands. It's reached through SubCommand since LLVM 16.
+inline llvm::cl::SubCommand &topLevelSubCommand() {
+#if LLVM_VERSION_MAJOR >= 16
+  return llvm::cl::SubCommand::getTopLevel();
+#else
+  return *llvm::cl::TopLevelSubCommand;
+#endif
+}
+
+// The CommonOptionsParser constructor, which exits on bad options, is
+// protected since LLVM 13. create reports them instead.
+inline llvm::Expected<std::unique_ptr<clang::tooling::CommonOptionsParser>>
+createOptionsParser(int &argc, const char **argv,
+                    llvm::cl::OptionCategory &category) {
+#if LLVM_VERSION_MAJOR >= 13
+  auto parser =
+      clang::tooling::CommonOptionsParser::create(argc, argv, category);
+  if (!parser)
+    return parser.takeError();
+  return std::make_unique<clang::tooling::CommonOptionsParser>(
+      std::move(*parser));
+#else
+  return std::make_unique<clang::tooling::CommonOptionsParser>(argc, argv,
+                                                               category);
+#endif
+}
+
+// createInvocationFromCommandLine was replaced by createInvocation in LLVM 15
+inline std::unique_ptr<clang::CompilerInvocation> createInvocation(
+    const std::vector<const char *> &argv,
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diagnostics,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs) {
+#if LLVM_VERSION_MAJOR >= 15
+  clang::CreateInvocationOptions options;
+  options.Diags = std::move(diagnostics);
+  options.VFS = std::move(fs);
+  return clang::createInvocation(argv, std::move(options));
+#else
+  return clang::createInvocationFromCommandLine(argv, std::move(diagnostics),
+                                                std::move(fs));
+#endif
+}
+
+// The profile readers go through a VFS since LLVM 17
+inline llvm::Expected<std::unique_ptr<llvm::IndexedInstrProfReader>>
+createProfileReader(llvm::StringRef path) {
+#if LLVM_VERSION_MAJOR >= 17
+  return llvm::IndexedInstrProfReader::create(path,
+                                              *llvm::vfs::getRealFileSystem());
+#else
+  return llvm::IndexedInstrProfReader::create(path);
+#endif
+}
+
+// Front-end instrumentation counts the function entry first. IR-level
+// instrumentation only does with -pgo-instrument-entry, which the profile
+// header records since LLVM 12.
+inline bool hasEntryCounts(const llvm::IndexedInstrProfReader &reader) {
+#if LLVM_VERSION_MAJOR >= 12
+  return !reader.isIRLevelProfile() || reader.instrEntryBBEnabled();
+#else
+  return !reader.isIRLevelProfile();
+#endif
+}
+
+} // namespace compat
+
+#endif // CONSTEXPR_EVERYTHING_COMPAT_H
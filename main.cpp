@@ -1,33 +1,320 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/DiagnosticAST.h"
 #include "clang/Basic/DiagnosticSema.h"
 #include "clang/Basic/PartialDiagnostic.h"
 #include "clang/Basic/Specifiers.h"
+#include "clang/Basic/Version.h"
+#include "clang/CodeGen/CodeGenAction.h"
+#include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/MultiplexConsumer.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
-#include "clang/Rewrite/Core/Rewriter.h"
-#include "clang/Rewrite/Frontend/FixItRewriter.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Index/USRGeneration.h"
+#include "clang/Lex/Lexer.h"
 #include "clang/Sema/Sema.h"
+#include "clang/Serialization/ASTWriter.h"
+#include "clang/Serialization/InMemoryModuleCache.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Core/Replacement.h"
+#include "clang/Tooling/ReplacementsYaml.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitstream/BitstreamWriter.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ProfileData/InstrProfReader.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/YAMLTraits.h"
+
+#include "compat.h"
 
 using namespace clang;
 using namespace clang::tooling;
 
 namespace {
+enum class OutputFormat { Text, JSONLines, SARIF };
+enum class Interpreter { Classic, Bytecode, Verify };
+
 llvm::cl::OptionCategory ConstexprCategory("constexpr-everything [-fix]");
 
 llvm::cl::extrahelp ConstexprCategoryHelp(R"(
 Use clang's existing constexpr validation code to automatically apply constexpr where appropriate
     )");
 
+llvm::cl::SubCommand
+    MergeCommand("merge", "combine the jsonl findings or exported fixes of "
+                          "several -shard runs");
+
+llvm::cl::opt<bool> ConstExprFixItOption(
+    "fix", llvm::cl::init(false),
+    llvm::cl::desc("apply fix-its to existing code"),
+    llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(MergeCommand));
+
+llvm::cl::opt<std::string> ExportFixesOption(
+    "export-fixes",
+    llvm::cl::desc("write the merged fix-its to a YAML file that "
+                   "clang-apply-replacements can apply"),
+    llvm::cl::value_desc("filename"), llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(MergeCommand));
+
+llvm::cl::opt<std::string> ShardOption(
+    "shard",
+    llvm::cl::desc("only process the K-th of N shards of the sources, "
+                   "balanced by estimated cost (1 <= K <= N)"),
+    llvm::cl::value_desc("K/N"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::SubCommand
+    UnlockCommand("unlock", "rank the out-of-line functions of an -index-dir "
+                            "by how many callers they would make constexpr "
+                            "if they were moved inline");
+
+llvm::cl::opt<std::string>
+    UnlockIndexOption(llvm::cl::Positional, llvm::cl::Required,
+                      llvm::cl::desc("<index directory>"),
+                      llvm::cl::cat(ConstexprCategory),
+                      llvm::cl::sub(UnlockCommand));
+
+llvm::cl::opt<unsigned>
+    UnlockTopOption("top", llvm::cl::init(20),
+                    llvm::cl::desc("how many functions to list (0 for all)"),
+                    llvm::cl::cat(ConstexprCategory),
+                    llvm::cl::sub(UnlockCommand));
+
+llvm::cl::list<std::string>
+    MergeInputsOption(llvm::cl::Positional, llvm::cl::OneOrMore,
+                      llvm::cl::desc("<jsonl or yaml files>"),
+                      llvm::cl::cat(ConstexprCategory),
+                      llvm::cl::sub(MergeCommand));
+
+llvm::cl::opt<unsigned>
+    JobsOption("j", llvm::cl::init(1),
+               llvm::cl::desc("number of translation units to process in "
+                              "parallel (0 uses every core)"),
+               llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> MaxMemoryOption(
+    "max-memory", llvm::cl::init(0),
+    llvm::cl::desc("only start another translation unit while the process's "
+                   "resident memory leaves room for it, in MiB (0 is "
+                   "unlimited)"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> HeadersOption(
+    "headers", llvm::cl::init(false),
+    llvm::cl::desc("also analyze functions and variables in non-system "
+                   "headers, each header decl is only checked once per run"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> TemplatesOption(
+    "templates", llvm::cl::init(false),
+    llvm::cl::desc("check the instantiations of function templates and "
+                   "members of class templates instead of their patterns, "
+                   "a template is only marked if every instantiation seen "
+                   "in the run can be constexpr"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> FoldCallsOption(
+    "fold-calls", llvm::cl::init(false),
+    llvm::cl::desc("report calls with constant arguments to functions made "
+                   "constexpr that a constexpr variable would evaluate at "
+                   "compile time, the fix-its are never applied by -fix"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> StrongestOption(
+    "strongest", llvm::cl::init(false),
+    llvm::cl::desc("in C++20 mode, suggest consteval for functions only ever "
+                   "called in constant expressions, and constinit for "
+                   "globals with a constant initializer that can't be "
+                   "constexpr"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> ClassesOption(
+    "classes", llvm::cl::init(false),
+    llvm::cl::desc("report the classes that still can't be used in constant "
+                   "expressions and the members that keep them from it; "
+                   "with unlock, rank classes instead of functions"),
+    llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(UnlockCommand));
+
+llvm::cl::opt<unsigned> ImpactOption(
+    "impact", llvm::cl::init(0),
+    llvm::cl::desc("compile N of the TUs with findings to object code in "
+                   "memory, as they are and with the fix-its applied, and "
+                   "report the difference in compile time, object size and "
+                   "emitted functions by directory"),
+    llvm::cl::value_desc("N"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<std::string> CacheDirOption(
+    "cache-dir", llvm::cl::init(""),
+    llvm::cl::desc("reuse results for translation units whose inputs haven't "
+                   "changed since the last run, stored in this directory"),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<std::string> ASTDirOption(
+    "ast-dir", llvm::cl::init(""),
+    llvm::cl::desc("serialize each translation unit's AST to this directory "
+                   "and analyze the serialized AST instead of parsing on "
+                   "later runs"),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> ServerOption(
+    "server",
+    llvm::cl::desc("answer requests for the candidates of a file on stdin "
+                   "while keeping parsed TUs in memory, the sources given "
+                   "are parsed up front"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> ServerUnitsOption(
+    "server-units", llvm::cl::init(16),
+    llvm::cl::desc("how many parsed TUs -server keeps in memory"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<std::string> IndexDirOption(
+    "index-dir",
+    llvm::cl::desc("write an index of every candidate's verdict and callees "
+                   "per TU to this directory, for the unlock subcommand"),
+    llvm::cl::value_desc("directory"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<bool> SkipFunctionBodiesOption(
+    "skip-function-bodies", llvm::cl::init(false),
+    llvm::cl::desc("don't parse the bodies of functions that can't be "
+                   "candidates, i.e. outside of the main file unless "
+                   "-headers is given"),
+    llvm::cl::cat(ConstexprCategory));
+
 llvm::cl::opt<bool>
-    ConstExprFixItOption("fix", llvm::cl::init(false),
-                         llvm::cl::desc("apply fix-its to existing code"),
-                         llvm::cl::cat(ConstexprCategory));
+    StatsOption("stats", llvm::cl::init(false),
+                llvm::cl::desc("print per translation unit and total timings "
+                               "and counters for each phase"),
+                llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<std::string> StatsJSONOption(
+    "stats-json", llvm::cl::init(""),
+    llvm::cl::desc("write the run's totals as JSON to this file, with its "
+                   "throughput, the latency percentiles of candidate "
+                   "evaluations and the peak memory use"),
+    llvm::cl::value_desc("filename"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<std::string> TimeTraceOption(
+    "time-trace", llvm::cl::init(""),
+    llvm::cl::desc("write a Chrome trace of every phase, in the same format "
+                   "as -ftime-trace, to this file"),
+    llvm::cl::value_desc("filename"), llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> TimeTraceGranularityOption(
+    "time-trace-granularity", llvm::cl::init(500),
+    llvm::cl::desc("minimum duration of a traced event, in microseconds"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> ConstexprStepsOption(
+    "constexpr-steps", llvm::cl::init(0),
+    llvm::cl::desc("maximum number of evaluation steps per candidate, like "
+                   "-fconstexpr-steps (0 keeps the compile command's)"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> ConstexprDepthOption(
+    "constexpr-depth", llvm::cl::init(0),
+    llvm::cl::desc("maximum call depth per candidate, like -fconstexpr-depth "
+                   "(0 keeps the compile command's)"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<Interpreter> InterpOption(
+    "interp", llvm::cl::init(Interpreter::Classic),
+    llvm::cl::desc("which constant evaluator checks the candidates"),
+    llvm::cl::values(
+        clEnumValN(Interpreter::Classic, "classic",
+                   "clang's tree-walking evaluator"),
+        clEnumValN(Interpreter::Bytecode, "bytecode",
+                   "the bytecode interpreter, LLVM 10 and newer"),
+        clEnumValN(Interpreter::Verify, "verify",
+                   "both, reporting where their verdicts differ, and the "
+                   "interpreter's speedup with -stats")),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<unsigned> EvalTimeLimitOption(
+    "eval-time-limit", llvm::cl::init(0),
+    llvm::cl::desc("milliseconds a translation unit may spend evaluating "
+                   "candidates, the rest are left undecided (0 is unlimited)"),
+    llvm::cl::cat(ConstexprCategory));
+
+llvm::cl::opt<OutputFormat> OutputFormatOption(
+    "output-format", llvm::cl::init(OutputFormat::Text),
+    llvm::cl::desc("how to report findings"),
+    llvm::cl::values(
+        clEnumValN(OutputFormat::Text, "text", "compiler diagnostics"),
+        clEnumValN(OutputFormat::JSONLines, "jsonl",
+                   "one JSON object per finding and line"),
+        clEnumValN(OutputFormat::SARIF, "sarif", "a SARIF 2.1.0 log")),
+    llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(MergeCommand));
+
+llvm::cl::opt<std::string> OutputOption(
+    "output", llvm::cl::init("-"),
+    llvm::cl::desc("where to write jsonl or sarif findings (default stdout)"),
+    llvm::cl::value_desc("filename"), llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(MergeCommand));
+
+llvm::cl::opt<std::string> ProfileOption(
+    "profile",
+    llvm::cl::desc("rank findings by how often the functions they affect "
+                   "ran, from an llvm-profdata indexed profile or a text file "
+                   "of '<mangled name> <count>' lines"),
+    llvm::cl::value_desc("filename"), llvm::cl::cat(ConstexprCategory),
+    llvm::cl::sub(compat::topLevelSubCommand()), llvm::cl::sub(MergeCommand));
 
 llvm::cl::extrahelp
     CommonHelp(clang::tooling::CommonOptionsParser::HelpMessage);
@@ -35,384 +322,4493 @@ llvm::cl::extrahelp
 
 namespace {
 
-// These functions are stolen from clang::Sema, where they're private.
-// From lib/Sema/SemaDeclCXX.cpp
-bool CheckConstexprDeclStmt(Sema &SemaRef, const FunctionDecl *Dcl,
-                            DeclStmt *DS, SourceLocation &Cxx1yLoc) {
-  // C++11 [dcl.constexpr]p3 and p4:
-  //  The definition of a constexpr function(p3) or constructor(p4) [...] shall
-  //  contain only
-  for (const auto *DclIt : DS->decls()) {
-    switch (DclIt->getKind()) {
-    case Decl::StaticAssert:
-    case Decl::Using:
-    case Decl::UsingShadow:
-    case Decl::UsingDirective:
-    case Decl::UnresolvedUsingTypename:
-    case Decl::UnresolvedUsingValue:
-      //   - static_assert-declarations
-      //   - using-declarations,
-      //   - using-directives,
-      continue;
+/*
+ * CandidateCache
+ *
+ * Verdicts for candidates outside of the main file, shared between all
+ * workers. Every TU that includes a header sees the same decls; the first TU
+ * to check one records the verdict and is the only one to report it, the
+ * others just reuse the verdict.
+ */
+class CandidateCache {
+public:
+  // (file, offset, USR)
+  using Key = std::tuple<std::string, unsigned, std::string>;
 
-    case Decl::Typedef:
-    case Decl::TypeAlias: {
-      //   - typedef declarations and alias-declarations that do not define
-      //     classes or enumerations,
-      const auto *TN = cast<TypedefNameDecl>(DclIt);
-      if (TN->getUnderlyingType()->isVariablyModifiedType()) {
-        // Don't allow variably-modified types in constexpr functions.
-        TypeLoc TL = TN->getTypeSourceInfo()->getTypeLoc();
-        SemaRef.Diag(TL.getBeginLoc(), diag::err_constexpr_vla)
-            << TL.getSourceRange() << TL.getType()
-            << isa<CXXConstructorDecl>(Dcl);
-        return false;
-      }
-      continue;
-    }
+  std::optional<bool> lookup(const Key &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = verdicts_.find(key);
+    if (it == verdicts_.end())
+      return std::nullopt;
+    return it->second;
+  }
 
-    case Decl::Enum:
-    case Decl::CXXRecord:
-      // C++1y allows types to be defined, not just declared.
-      if (cast<TagDecl>(DclIt)->isThisDeclarationADefinition())
-        SemaRef.Diag(DS->getBeginLoc(),
-                     SemaRef.getLangOpts().CPlusPlus14
-                         ? diag::warn_cxx11_compat_constexpr_type_definition
-                         : diag::ext_constexpr_type_definition)
-            << isa<CXXConstructorDecl>(Dcl);
-      continue;
+  // Returns false if another TU already recorded a verdict for key
+  bool insert(const Key &key, bool verdict) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return verdicts_.emplace(key, verdict).second;
+  }
 
-    case Decl::EnumConstant:
-    case Decl::IndirectField:
-    case Decl::ParmVar:
-      // These can only appear with other declarations which are banned in
-      // C++11 and permitted in C++1y, so ignore them.
-      continue;
+  // For candidates whose verdict no other TU depends on, returns true if this
+  // TU is the first to see key
+  bool claim(const Key &key) { return insert(key, false); }
 
-    case Decl::Var:
-    case Decl::Decomposition: {
-      // C++1y [dcl.constexpr]p3 allows anything except:
-      //   a definition of a variable of non-literal type or of static or
-      //   thread storage duration or for which no initialization is performed.
-      const auto *VD = cast<VarDecl>(DclIt);
-      if (VD->isThisDeclarationADefinition()) {
-        if (VD->isStaticLocal()) {
-          SemaRef.Diag(VD->getLocation(), diag::err_constexpr_local_var_static)
-              << isa<CXXConstructorDecl>(Dcl)
-              << (VD->getTLSKind() == VarDecl::TLS_Dynamic);
-          return false;
-        }
-        if (!VD->getType()->isDependentType() &&
-            SemaRef.RequireLiteralType(
-                VD->getLocation(), VD->getType(),
-                diag::err_constexpr_local_var_non_literal_type,
-                isa<CXXConstructorDecl>(Dcl)))
-          return false;
-        if (!VD->getType()->isDependentType() && !VD->hasInit() &&
-            !VD->isCXXForRangeDecl()) {
-#if (LLVM_VERSION_MAJOR == 10)
-          SemaRef.Diag(VD->getLocation(), diag::ext_constexpr_local_var_no_init)
-              << isa<CXXConstructorDecl>(Dcl);
-#else
-          SemaRef.Diag(VD->getLocation(), diag::err_constexpr_local_var_no_init)
-              << isa<CXXConstructorDecl>(Dcl);
+  // For -server, where the same headers are analyzed again after they changed
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    verdicts_.clear();
+  }
+
+private:
+  std::mutex mutex_;
+  std::map<Key, bool> verdicts_;
+};
+
+CandidateCache &candidateCache() {
+  static CandidateCache cache;
+  return cache;
+}
+
+/*
+ * Statistics
+ *
+ * Timings and counters for a single TU with -stats and -time-trace, main()
+ * sums them up over all TUs. Counters are always kept since they're just
+ * increments, the clocks are only read when asked for.
+ */
+struct Statistics {
+  enum Phase {
+    Frontend,
+    Traversal,
+    PreFilter,
+    SemaChecks,
+    PotentialConstantExpr,
+    VariableEvaluation,
+    CallEvaluation,
+    BytecodeVerification,
+    ApplyFixes,
+    NumPhases
+  };
+
+  enum Counter {
+    FunctionsVisited,
+    FunctionsNotCandidateLocation,
+    FunctionsAlreadyConstexpr,
+    FunctionsMain,
+    FunctionsDestructor,
+    FunctionsTemplatePattern,
+    FunctionsCachedVerdict,
+    FunctionsChecked,
+    FunctionsRejectedSema,
+    FunctionsRejectedNoBody,
+    FunctionsRejectedParameterTypes,
+    FunctionsRejectedReturnType,
+    FunctionsRejectedStatement,
+    FunctionsRejectedCall,
+    FunctionsRejectedNewDelete,
+    FunctionsRejectedNotConstant,
+    FunctionsAccepted,
+    FunctionsConsteval,
+    InstantiationsChecked,
+    InstantiationsAccepted,
+    ClassesChecked,
+    ClassesNotUsable,
+    VariablesVisited,
+    GlobalsVisited,
+    VariablesEvaluated,
+    VariablesRejectedNonLiteral,
+    VariablesAccepted,
+    GlobalsAccepted,
+    GlobalsConstinit,
+    DynamicInitializersRemoved,
+    CallsFolded,
+    FunctionsUndecided,
+    VariablesUndecided,
+    EvaluationTimeSpent,
+    DeclsLeftToAnotherTU,
+    EvaluatorVerdictsCompared,
+    EvaluatorVerdictsDiffering,
+    LiteralTypesChecked,
+    LiteralTypesCached,
+    NumCounters
+  };
+
+  struct Time {
+    double Wall = 0;
+    double CPU = 0;
+  };
+
+  struct Timestamp {
+    std::chrono::steady_clock::time_point Wall;
+    double CPU = 0;
+  };
+
+  // A complete ("X") event of a Chrome trace
+  struct TraceEvent {
+    const char *Name;
+    std::string Detail;
+    uint64_t Thread;
+    uint64_t Start;
+    uint64_t Duration;
+  };
+
+  Time Phases[NumPhases];
+  uint64_t Counters[NumCounters] = {};
+  std::vector<TraceEvent> Trace;
+  // With -stats-json, the wall time of every candidate evaluation in seconds
+  std::vector<double> Latencies;
+
+  static bool enabled() {
+    return StatsOption || !StatsJSONOption.empty() || !TimeTraceOption.empty();
+  }
+
+  static const char *name(Phase phase) {
+    static const char *const names[NumPhases] = {
+        "Frontend",
+        "Traversal",
+        "PreFilter",
+        "CheckConstexprFunctionDefinition",
+        "isPotentialConstantExpr",
+        "evaluateValue",
+        "EvaluateAsRValue",
+        "bytecode interpreter (-interp=verify)",
+        "ApplyFixes",
+    };
+    return names[phase];
+  }
+
+  static const char *name(Counter counter) {
+    static const char *const names[NumCounters] = {
+        "functions visited",
+        "functions rejected: not in a candidate location",
+        "functions rejected: already constexpr",
+        "functions rejected: main",
+        "functions rejected: destructor",
+        "functions left to their instantiations",
+        "functions decided by another TU",
+        "functions checked",
+        "functions rejected: constexpr definition checks",
+        "functions rejected: no body",
+        "functions rejected: non-literal parameter types",
+        "functions rejected: non-literal return type",
+        "functions rejected: asm, goto or try",
+        "functions rejected: always calls a non-constexpr function",
+        "functions rejected: always uses new or delete",
+        "functions rejected: not a potential constant expression",
+        "functions accepted",
+        "functions accepted as consteval",
+        "template instantiations checked",
+        "template instantiations accepted",
+        "classes checked",
+        "classes not usable in constant expressions",
+        "variables visited",
+        "globals and static members visited",
+        "variables evaluated",
+        "variables rejected: non-literal type",
+        "variables accepted",
+        "globals and static members accepted",
+        "globals and static members accepted as constinit",
+        "dynamic initializers removed",
+        "runtime calls eliminated by constexpr variables",
+        "functions undecided: evaluation budget exceeded",
+        "variables undecided: evaluation budget exceeded",
+        "TUs that used up their evaluation time",
+        "header decls left to the TU that claimed them",
+        "verdicts compared between the evaluators",
+        "verdicts that differ between the evaluators",
+        "literal types checked",
+        "literal types answered from the cache",
+    };
+    return names[counter];
+  }
+
+  // CPU time of the calling thread, workers share the process
+  static double threadCPUTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+      return ts.tv_sec + ts.tv_nsec / 1e9;
 #endif
-          return false;
-        }
-      }
-      SemaRef.Diag(VD->getLocation(),
-                   SemaRef.getLangOpts().CPlusPlus14
-                       ? diag::warn_cxx11_compat_constexpr_local_var
-                       : diag::ext_constexpr_local_var)
-          << isa<CXXConstructorDecl>(Dcl);
-      continue;
+    return double(std::clock()) / CLOCKS_PER_SEC;
+  }
+
+  static Timestamp now() {
+    Timestamp timestamp;
+    if (enabled()) {
+      timestamp.Wall = std::chrono::steady_clock::now();
+      timestamp.CPU = threadCPUTime();
     }
+    return timestamp;
+  }
 
-    case Decl::NamespaceAlias:
-    case Decl::Function:
-      // These are disallowed in C++11 and permitted in C++1y. Allow them
-      // everywhere as an extension.
-      if (!Cxx1yLoc.isValid())
-        Cxx1yLoc = DS->getBeginLoc();
-      continue;
+  // The time base of the trace. main() sets it before any TU starts, so
+  // every worker's events come after it.
+  static std::chrono::steady_clock::time_point &traceStart() {
+    static std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    return start;
+  }
 
-    default:
-      SemaRef.Diag(DS->getBeginLoc(), diag::err_constexpr_body_invalid_stmt)
-          << isa<CXXConstructorDecl>(Dcl);
-      return false;
+  // Microseconds since the start of the trace, events from before it are
+  // moved to its start
+  static uint64_t traceTime(std::chrono::steady_clock::time_point time) {
+    auto since = std::chrono::duration_cast<std::chrono::microseconds>(
+                     time - traceStart())
+                     .count();
+    return since < 0 ? 0 : static_cast<uint64_t>(since);
+  }
+
+  void count(Counter counter) { ++Counters[counter]; }
+
+  // Whether a verdict was cut short by -constexpr-steps, -constexpr-depth or
+  // -eval-time-limit, and so might differ in another run
+  bool hitEvaluationBudget() const {
+    return Counters[FunctionsUndecided] != 0 ||
+           Counters[VariablesUndecided] != 0 ||
+           Counters[EvaluationTimeSpent] != 0;
+  }
+
+  // With -headers, whether another TU claimed some of the header decls, whose
+  // findings are then left out of this TU's result
+  bool deferredToAnotherTU() const {
+    return Counters[FunctionsCachedVerdict] != 0 ||
+           Counters[DeclsLeftToAnotherTU] != 0;
+  }
+
+  void record(Phase phase, const Timestamp &start,
+              llvm::function_ref<std::string()> detail) {
+    if (!enabled())
+      return;
+
+    auto end = now();
+    auto wall = std::chrono::duration<double>(end.Wall - start.Wall).count();
+    Phases[phase].Wall += wall;
+    Phases[phase].CPU += end.CPU - start.CPU;
+
+    if (!StatsJSONOption.empty() &&
+        (phase == PotentialConstantExpr || phase == VariableEvaluation ||
+         phase == CallEvaluation))
+      Latencies.push_back(wall);
+
+    if (TimeTraceOption.empty() || wall * 1e6 < TimeTraceGranularityOption)
+      return;
+
+    auto begin = traceTime(start.Wall);
+    Trace.push_back(TraceEvent{name(phase), detail(), llvm::get_threadid(),
+                               begin, traceTime(end.Wall) - begin});
+  }
+
+  void add(const Statistics &other) {
+    for (unsigned i = 0; i < NumPhases; ++i) {
+      Phases[i].Wall += other.Phases[i].Wall;
+      Phases[i].CPU += other.Phases[i].CPU;
     }
+    for (unsigned i = 0; i < NumCounters; ++i)
+      Counters[i] += other.Counters[i];
+    Latencies.insert(Latencies.end(), other.Latencies.begin(),
+                     other.Latencies.end());
   }
 
-  return true;
-}
+  void print(llvm::raw_ostream &os, llvm::StringRef title) const {
+    os << "===" << std::string(73, '-') << "===\n"
+       << "  constexpr-everything statistics: " << title << "\n"
+       << "===" << std::string(73, '-') << "===\n";
+    os << llvm::format("  %-40s %12s %12s\n", "phase", "wall (s)", "cpu (s)");
+    for (unsigned i = 0; i < NumPhases; ++i)
+      os << llvm::format("  %-40s %12.4f %12.4f\n",
+                         name(static_cast<Phase>(i)), Phases[i].Wall,
+                         Phases[i].CPU);
+    os << "\n";
+    for (unsigned i = 0; i < NumCounters; ++i)
+      os << llvm::format("  %-56s %12llu\n", name(static_cast<Counter>(i)),
+                         static_cast<unsigned long long>(Counters[i]));
 
-// CheckConstexprParameterTypes - Check whether a function's parameter types
-// are all literal types. If so, return true. If not, produce a suitable
-// diagnostic and return false.
-
-// from lib/Sema/SemaDeclCXX.cpp
-static bool CheckConstexprParameterTypes(Sema &SemaRef,
-                                         const FunctionDecl *FD) {
-  unsigned ArgIndex = 0;
-  const FunctionProtoType *FT = FD->getType()->getAs<FunctionProtoType>();
-  for (FunctionProtoType::param_type_iterator i = FT->param_type_begin(),
-                                              e = FT->param_type_end();
-       i != e; ++i, ++ArgIndex) {
-    const ParmVarDecl *PD = FD->getParamDecl(ArgIndex);
-    SourceLocation ParamLoc = PD->getLocation();
-    if (!(*i)->isDependentType() &&
-        SemaRef.RequireLiteralType(
-            ParamLoc, *i, diag::err_constexpr_non_literal_param, ArgIndex + 1,
-            PD->getSourceRange(), isa<CXXConstructorDecl>(FD)))
-      return false;
+    // What the pre-filtered functions would have cost at the average of the
+    // ones that did go through Sema's checks and the evaluator
+    auto prefiltered = Counters[FunctionsRejectedStatement] +
+                       Counters[FunctionsRejectedCall] +
+                       Counters[FunctionsRejectedNewDelete];
+    auto checked = Counters[FunctionsChecked] - prefiltered -
+                   Counters[FunctionsRejectedNoBody] -
+                   Counters[FunctionsRejectedReturnType] -
+                   Counters[FunctionsRejectedParameterTypes];
+    if (prefiltered != 0 && checked != 0) {
+      double perFunction =
+          (Phases[SemaChecks].Wall + Phases[PotentialConstantExpr].Wall) /
+          checked;
+      os << llvm::format("  %-56s %12.4f\n",
+                         "estimated wall time saved by the pre-filter (s)",
+                         perFunction * prefiltered - Phases[PreFilter].Wall);
+    }
+
+    // With -interp=verify, the classic evaluator's phases against the same
+    // evaluations in the bytecode interpreter
+    if (Phases[BytecodeVerification].Wall > 0) {
+      double classic = Phases[PotentialConstantExpr].Wall +
+                       Phases[VariableEvaluation].Wall +
+                       Phases[CallEvaluation].Wall;
+      os << llvm::format("  %-56s %12.2f\n",
+                         "bytecode interpreter speedup over the classic (x)",
+                         classic / Phases[BytecodeVerification].Wall);
+    }
+    os << "\n";
   }
-  return true;
-}
-} // namespace
+};
+
+// Times a phase for as long as it's in scope
+class PhaseTimer {
+  Statistics &stats_;
+  Statistics::Phase phase_;
+  const clang::NamedDecl *decl_;
+  Statistics::Timestamp start_;
+
+public:
+  PhaseTimer(Statistics &stats, Statistics::Phase phase,
+             const clang::NamedDecl *decl = nullptr)
+      : stats_(stats), phase_(phase), decl_(decl), start_(Statistics::now()) {}
+
+  ~PhaseTimer() {
+    stats_.record(phase_, start_, [this] {
+      return decl_ ? decl_->getQualifiedNameAsString() : std::string();
+    });
+  }
+};
 
 /*
- * ConstexprFunctionASTVisitor
+ * LiteralTypeCache
  *
- * Find all functions that can be constexpr but arent. Create diagnostics for
- * them and mark them constexpr for the next pass.
+ * Whether a type is a literal type, for the lifetime of a TU. Sema's
+ * RequireLiteralType completes class types first, which can declare their
+ * implicit members, and the same few types keep coming back as parameters of
+ * candidate after candidate. cv-qualifiers don't change whether a type is a
+ * literal type, so types are keyed without them.
  */
-class ConstexprFunctionASTVisitor
-    : public clang::RecursiveASTVisitor<ConstexprFunctionASTVisitor> {
-  clang::SourceManager &sourceManager_;
-  clang::CompilerInstance &CI_;
-  clang::DiagnosticsEngine &DE;
-
+class LiteralTypeCache {
 public:
-  explicit ConstexprFunctionASTVisitor(clang::SourceManager &sm,
-                                       clang::CompilerInstance &ci)
-      : sourceManager_(sm), CI_(ci), DE(ci.getASTContext().getDiagnostics()) {}
-
-  bool VisitFunctionDecl(clang::FunctionDecl *func) {
+  LiteralTypeCache(clang::Sema &sema, Statistics &stats)
+      : sema_(sema), stats_(stats) {}
 
-    // Only functions in our TU
-    SourceLocation loc = func->getSourceRange().getBegin();
-    if (!sourceManager_.isWrittenInMainFile(loc))
+  // Only call this with diagnostics suppressed, completing the type may
+  // diagnose it
+  bool isLiteral(clang::QualType type, clang::SourceLocation loc) {
+    if (type->isDependentType())
       return true;
 
-    // Skip existing constExpr functions
-    if (func->isConstexpr())
-      return true;
+    auto key = sema_.Context.getCanonicalType(type).getUnqualifiedType();
+    auto it = literal_.find(key);
+    if (it != literal_.end()) {
+      stats_.count(Statistics::LiteralTypesCached);
+      return it->second;
+    }
 
-    // Don't mark main as constexpr
-    if (func->isMain())
-      return true;
+    stats_.count(Statistics::LiteralTypesChecked);
+    SilentDiagnoser diagnoser;
+    bool literal = !sema_.RequireLiteralType(loc, type, diagnoser);
+    literal_.try_emplace(key, literal);
+    return literal;
+  }
 
-    // Destructors can't be constexpr
-    if (isa<CXXDestructorDecl>(func))
-      return true;
+private:
+  struct SilentDiagnoser : clang::Sema::TypeDiagnoser {
+    void diagnose(clang::Sema &, clang::SourceLocation,
+                  clang::QualType) override {}
+  };
 
-    auto &sema = CI_.getSema();
+  clang::Sema &sema_;
+  Statistics &stats_;
+  llvm::DenseMap<clang::QualType, bool> literal_;
+};
 
-    // Temporarily disable diagnostics for these next functions, use a
-    // unique_ptr deleter to handle restoring it
-    sema.getDiagnostics().setSuppressAllDiagnostics(true);
-    {
-      auto returnDiagnostics = [&sema](int *) {
-        sema.getDiagnostics().setSuppressAllDiagnostics(false);
-      };
-      int lol = 0;
-      std::unique_ptr<int, decltype(returnDiagnostics)> scope(
-          &lol, returnDiagnostics);
+/*
+ * Finding
+ *
+ * A single "can be constexpr" result. Findings are recorded regardless of the
+ * output format; with -output-format=text they are also reported as
+ * diagnostics, otherwise main() streams them without going through the
+ * diagnostic renderer.
+ */
+struct Finding {
+  // Instantiation findings only record how one instantiation of a template
+  // fared, main() and merge() decide the template from all of them
+  enum Kind { Function, Variable, Instantiation };
 
-#if LLVM_VERSION_MAJOR >= 10
-      if (!sema.CheckConstexprFunctionDefinition(
-              func, Sema::CheckConstexprKind::CheckValid))
-        return true;
-#else
-      if (!sema.CheckConstexprFunctionDecl(func))
-        return true;
-#endif
+  Kind kind;
+  // As recorded by the SourceManager, may be relative to the TU's directory
+  std::string File;
+  unsigned Offset;
+  unsigned Line;
+  unsigned Column;
+  std::string Name;
+  std::string USR;
+  std::string FixIt;
+  // A global whose initializer only becomes constant through functions this
+  // run makes constexpr, so it no longer needs a dynamic initializer
+  bool RemovesDynamicInitializer = false;
+  // A function template, or member of a class template, decided from its
+  // instantiations
+  bool Template = false;
+  // Instantiation findings are at their pattern's location, with these added
+  std::string Instantiation;
+  bool Constant = false;
+  // With -profile, the mangled name of the function whose executions the
+  // finding saves work in, and how often the profile says it ran
+  std::string Symbol;
+  uint64_t Weight = 0;
+  // Outside of the main file, decided by whichever TU claimed it first. It's
+  // reported once all TUs are done, so the output doesn't depend on which.
+  bool Shared = false;
 
-      // We can't check this if we don't have a function body.
-      if (!func->getBody())
-        return true;
+  static const char *name(Kind kind) {
+    switch (kind) {
+    case Function:
+      return "function";
+    case Variable:
+      return "variable";
+    case Instantiation:
+      return "instantiation";
+    }
+    llvm_unreachable("unknown finding kind");
+  }
+};
 
-#if LLVM_VERSION_MAJOR <= 9
-      if (!sema.CheckConstexprFunctionBody(func, func->getBody()))
-        return true;
-#endif
+// The order of findings in the output, by position
+bool findingBefore(const Finding &a, const Finding &b) {
+  return std::tie(a.File, a.Offset, a.kind, a.Name, a.Instantiation) <
+         std::tie(b.File, b.Offset, b.kind, b.Name, b.Instantiation);
+}
 
-      if (!CheckConstexprParameterTypes(sema, func))
-        return true;
-    }
+/*
+ * IndexedFunction
+ *
+ * What -index-dir records about a candidate with a body: its final verdict,
+ * whether it was only rejected because it calls functions that aren't
+ * constexpr in this TU, the class it's a member of and its callees with their
+ * state in this TU.
+ */
+struct IndexedFunction {
+  enum Flags : unsigned {
+    Constexpr = 1 << 0,
+    BlockedByCalls = 1 << 1,
+    InMainFile = 1 << 2,
+  };
 
-    SmallVector<PartialDiagnosticAt, 8> Diags;
-    if (!Expr::isPotentialConstantExpr(func, Diags))
-      return true;
+  struct Callee {
+    enum Flags : unsigned {
+      Constexpr = 1 << 0,
+      Defined = 1 << 1,
+    };
 
-    // Mark function as constexpr, the next ast visitor will use this
-    // information to find constexpr vardecls
-    func->setConstexprKind(CSK_constexpr);
+    std::string USR;
+    unsigned Flags;
+  };
 
-    // Create diagnostic
-    const auto FixIt = clang::FixItHint::CreateInsertion(loc, "constexpr ");
-    const auto ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning,
-                                       "function can be constexpr");
+  std::string USR;
+  std::string Name;
+  // As recorded by the SourceManager, may be relative to the TU's directory
+  std::string File;
+  unsigned Line;
+  unsigned Flags;
+  // Empty for functions that aren't members of a class
+  std::string Record;
+  std::string RecordName;
+  std::vector<Callee> Callees;
+};
 
-    DE.Report(loc, ID).AddFixItHint(FixIt);
+// Whether an evaluation gave up because it ran into the step or depth limit,
+// rather than because the expression isn't constant
+bool hitEvaluationLimit(
+    const llvm::SmallVectorImpl<clang::PartialDiagnosticAt> &notes) {
+  for (const auto &note : notes) {
+    const auto id = note.second.getDiagID();
+    if (id == clang::diag::note_constexpr_step_limit_exceeded ||
+        id == clang::diag::note_constexpr_depth_limit_exceeded)
+      return true;
+  }
+  return false;
+}
 
-    return true;
+// Whether every reason the evaluator gave for a function not being constant
+// is a call to a non-constexpr function
+bool onlyBlockedByCalls(
+    const llvm::SmallVectorImpl<clang::PartialDiagnosticAt> &notes) {
+  bool calls = false;
+  for (const auto &note : notes) {
+    const auto id = note.second.getDiagID();
+    if (id == clang::diag::note_constexpr_invalid_function)
+      calls = true;
+    else if (id != clang::diag::note_declared_at)
+      return false;
   }
-};
+  return calls;
+}
 
-class ConstexprVarDeclFunctionASTVisitor
-    : public clang::RecursiveASTVisitor<ConstexprVarDeclFunctionASTVisitor> {
-  clang::SourceManager &sourceManager_;
-  clang::CompilerInstance &CI_;
-  clang::DiagnosticsEngine &DE;
+// Whether func is constexpr by now, ours are marked on the definition
+bool isConstexprNow(const clang::FunctionDecl *func) {
+  const clang::FunctionDecl *definition = nullptr;
+  return func->isConstexpr() ||
+         (func->isDefined(definition) && definition->isConstexpr());
+}
 
-  class ConstexprVarDeclVisitor
-      : public clang::RecursiveASTVisitor<ConstexprVarDeclVisitor> {
-    clang::CompilerInstance &CI_;
-    clang::DiagnosticsEngine &DE;
+// Whether a value of record can be created in a constant expression other
+// than by copying one, as a literal type requires
+bool isConstructibleInConstantExpressions(const clang::CXXRecordDecl *record) {
+  if (record->isAggregate() || record->hasTrivialDefaultConstructor())
+    return true;
 
-  public:
-    explicit ConstexprVarDeclVisitor(clang::CompilerInstance &ci)
-        : CI_(ci), DE(ci.getASTContext().getDiagnostics()) {}
+  for (const auto *ctor : record->ctors())
+    if (!ctor->isCopyOrMoveConstructor() && isConstexprNow(ctor))
+      return true;
+  return record->needsImplicitDefaultConstructor() &&
+         record->defaultedDefaultConstructorIsConstexpr();
+}
 
-    bool VisitDeclStmt(clang::DeclStmt *stmt) {
-      if (!stmt->isSingleDecl())
-        return true;
+// Whether type is a literal type once the constructors this run promoted are
+// constexpr. Type::isLiteralType reads flags Sema computed for the class
+// definition while parsing, so a class that only gets a constexpr constructor
+// from us, and every class holding one by value, still looks non-literal.
+bool isLiteralAfterPromotion(const clang::ASTContext &context,
+                             clang::QualType type) {
+  if (type->isLiteralType(context))
+    return true;
 
-      clang::VarDecl *var =
-          clang::dyn_cast<clang::VarDecl>(*stmt->decl_begin());
-      if (!var)
-        return true;
+  type = context.getBaseElementType(type);
+  const auto *record = type->getAsCXXRecordDecl();
+  if (!record || !record->hasDefinition() || type.isVolatileQualified())
+    return false;
+  record = record->getDefinition();
 
-      // Skip variables that are already constexpr
-      if (var->isConstexpr())
-        return true;
+  if (!record->hasTrivialDestructor() || record->isLambda())
+    return false;
 
-      // Only do locals for right now
-      if (!var->hasLocalStorage())
-        return true;
+  for (const auto &base : record->bases())
+    if (!isLiteralAfterPromotion(context, base.getType()))
+      return false;
+  for (const auto *field : record->fields())
+    if (field->getType().isVolatileQualified() ||
+        !isLiteralAfterPromotion(context, field->getType()))
+      return false;
 
-      clang::SourceLocation loc = stmt->getSourceRange().getBegin();
-      auto &sema = CI_.getSema();
+  return isConstructibleInConstantExpressions(record);
+}
 
-      // var needs an initializer
-      Expr *Init = var->getInit();
-      if (!Init)
-        return true;
+// Main file decls are always candidates, headers only when asked for
+bool isCandidateLocation(const clang::SourceManager &sm,
+                         clang::SourceLocation loc) {
+  if (sm.isWrittenInMainFile(loc))
+    return true;
 
-      // If the var is const we can mark it constexpr
-      QualType ty = var->getType();
-      if (!ty.isConstQualified())
-        return true;
+  return HeadersOption && loc.isValid() && !sm.isInSystemHeader(loc);
+}
 
-      // Is init an integral constant expression
-      if (!var->checkInitIsICE())
-        return true;
+// Builds the cache key for a decl outside of the main file. Returns false if
+// the decl isn't shared with other TUs and doesn't need one.
+bool getSharedCandidateKey(const clang::SourceManager &sm,
+                           const clang::Decl *decl, clang::SourceLocation loc,
+                           CandidateCache::Key &key) {
+  if (sm.isWrittenInMainFile(loc))
+    return false;
 
-      // Does the init function use dependent values
-      if (Init->isValueDependent())
-        return true;
+  auto decomposed = sm.getDecomposedLoc(sm.getFileLoc(loc));
+  llvm::StringRef file =
+      compat::fileName(sm, decomposed.first, /*realPath=*/true);
+  if (file.empty())
+    return false;
 
-      // Can we evaluate the value
-      if (!var->evaluateValue())
-        return true;
+  llvm::SmallString<128> usr;
+  if (clang::index::generateUSRForDecl(decl, usr))
+    usr.clear();
 
-      // Is init an ice
-      if (!var->isInitICE())
-        return true;
+  key = CandidateCache::Key(file.str(), decomposed.second, usr.str().str());
+  return true;
+}
+
+/*
+ * AlwaysEvaluatedScan
+ *
+ * The part of the pre-filter that looks for calls and new/delete a constant
+ * expression can't evaluate. Those only disqualify a body if they're reached
+ * on every path through it, so only the leading statements of the body are
+ * scanned, up to the first one that could branch, and operands that might
+ * not be evaluated are skipped. A call only counts if the callee can never
+ * become constexpr: it isn't constexpr or a builtin and has no definition at
+ * a location we would mark.
+ */
+class AlwaysEvaluatedScan {
+public:
+  AlwaysEvaluatedScan(const clang::SourceManager &sm,
+                      const clang::LangOptions &langOpts)
+      : sourceManager_(sm), langOpts_(langOpts) {}
 
-      // Create Diagnostic/FixIt
-      const auto FixIt = clang::FixItHint::CreateInsertion(loc, "constexpr ");
-      const auto ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning,
-                                         "variable can be constexpr");
+  // Returns the reason to reject, or None
+  std::optional<Statistics::Counter> scanBody(const clang::Stmt *body) {
+    const auto *compound = clang::dyn_cast_or_null<clang::CompoundStmt>(body);
+    if (!compound)
+      return std::nullopt;
 
-      DE.Report(loc, ID).AddFixItHint(FixIt);
+    for (const auto *stmt : compound->body()) {
+      if (!isa<clang::Expr>(stmt) && !isa<clang::DeclStmt>(stmt) &&
+          !isa<clang::ReturnStmt>(stmt) && !isa<clang::NullStmt>(stmt))
+        return std::nullopt;
 
-      return true;
+      if (auto reason = scan(stmt))
+        return reason;
+      if (isa<clang::ReturnStmt>(stmt))
+        return std::nullopt;
     }
-  };
+    return std::nullopt;
+  }
 
-public:
-  explicit ConstexprVarDeclFunctionASTVisitor(clang::SourceManager &sm,
-                                              clang::CompilerInstance &ci)
-      : sourceManager_(sm), CI_(ci), DE(ci.getASTContext().getDiagnostics()) {}
+private:
+  const clang::SourceManager &sourceManager_;
+  const clang::LangOptions &langOpts_;
 
-  bool VisitFunctionDecl(clang::FunctionDecl *func) {
-    // Only functions in our TU
-    SourceLocation loc = func->getSourceRange().getBegin();
-    if (!sourceManager_.isWrittenInMainFile(loc))
-      return true;
+  bool neverConstexpr(const clang::FunctionDecl *callee) const {
+    if (callee->isConstexpr())
+      return false;
 
-    // Don't go through functions that are already constexpr
-    if (func->isConstexpr())
+    const clang::FunctionDecl *definition = nullptr;
+    if (!callee->isDefined(definition))
       return true;
+    return !isCandidateLocation(sourceManager_,
+                                definition->getSourceRange().getBegin());
+  }
 
-    ConstexprVarDeclVisitor vd(CI_);
-    vd.TraverseFunctionDecl(func);
+  std::optional<Statistics::Counter> scan(const clang::Stmt *stmt) {
+    if (!stmt)
+      return std::nullopt;
 
-    return true;
-  }
-};
+    // Not evaluated, or not necessarily evaluated
+    if (isa<clang::LambdaExpr>(stmt) ||
+        isa<clang::UnaryExprOrTypeTraitExpr>(stmt) ||
+        isa<clang::CXXTypeidExpr>(stmt) || isa<clang::CXXNoexceptExpr>(stmt) ||
+        isa<clang::StmtExpr>(stmt))
+      return std::nullopt;
 
-class ConstexprEverythingASTConsumer : public clang::ASTConsumer {
-  ConstexprFunctionASTVisitor functionVisitor;
-  ConstexprVarDeclFunctionASTVisitor varDeclVisitor;
+    if (const auto *conditional =
+            clang::dyn_cast<clang::AbstractConditionalOperator>(stmt))
+      return scan(conditional->getCond());
 
-public:
-  // override the constructor in order to pass CI
-  explicit ConstexprEverythingASTConsumer(clang::CompilerInstance &ci)
-      : functionVisitor(ci.getSourceManager(), ci),
-        varDeclVisitor(ci.getSourceManager(), ci) {}
+    if (const auto *binary = clang::dyn_cast<clang::BinaryOperator>(stmt))
+      if (binary->isLogicalOp())
+        return scan(binary->getLHS());
+
+    if ((isa<clang::CXXNewExpr>(stmt) || isa<clang::CXXDeleteExpr>(stmt)) &&
+        !compat::isCPlusPlus20(langOpts_))
+      return Statistics::FunctionsRejectedNewDelete;
+
+    if (const auto *call = clang::dyn_cast<clang::CallExpr>(stmt))
+      if (const auto *callee = call->getDirectCallee()) {
+        // Some builtins don't evaluate their arguments, like
+        // __builtin_constant_p, only the evaluator knows which do
+        if (callee->getBuiltinID() != 0)
+          return std::nullopt;
+        if (neverConstexpr(callee))
+          return Statistics::FunctionsRejectedCall;
+      }
 
-  void HandleTranslationUnit(clang::ASTContext &astContext) override {
-    functionVisitor.TraverseDecl(astContext.getTranslationUnitDecl());
-    varDeclVisitor.TraverseDecl(astContext.getTranslationUnitDecl());
+    for (const auto *child : stmt->children())
+      if (auto reason = scan(child))
+        return reason;
+    return std::nullopt;
   }
 };
+} // namespace
 
-class FunctionDeclFrontendAction : public clang::ASTFrontendAction {
+/*
+ * ConstexprEverythingASTVisitor
+ *
+ * Find all functions and local variables that can be constexpr but arent, in
+ * a single traversal. The traversal only collects candidates, the functions
+ * each function calls and the local variable declarations; solve() then
+ * decides the functions callees first, marks them constexpr and only then
+ * evaluates the variables, since whether a variable can be constexpr depends
+ * on the functions its initializer calls.
+ */
+class ConstexprEverythingASTVisitor
+    : public clang::RecursiveASTVisitor<ConstexprEverythingASTVisitor> {
+  using Base = clang::RecursiveASTVisitor<ConstexprEverythingASTVisitor>;
 
-  class ConstexprFixItOptions : public clang::FixItOptions {
-    std::string RewriteFilename(const std::string &Filename, int &fd) override {
-      return Filename;
-    }
+  clang::SourceManager &sourceManager_;
+  clang::Sema &sema_;
+  clang::DiagnosticsEngine &DE;
+  Statistics &stats_;
+  std::vector<Finding> &findings_;
+  // Only with -index-dir
+  std::vector<IndexedFunction> *index_;
+  LiteralTypeCache literalTypes_;
+  // Only with -profile, created for the first finding
+  std::unique_ptr<compat::SymbolNameGenerator> names_;
+
+  struct Candidate {
+    clang::FunctionDecl *func = nullptr;
+    clang::SourceLocation loc;
+    bool shared = false;
+    CandidateCache::Key key;
+    bool verdict = false;
+    // Ran out of evaluation budget, never checked again
+    bool undecided = false;
+    // Last rejected only because of calls to non-constexpr functions
+    bool blocked = false;
+    // With -templates, an instantiation standing in for its pattern
+    bool instantiation = false;
+    // With -strongest, every use is a constant call
+    bool consteval = false;
   };
 
-  std::unique_ptr<clang::FixItRewriter> rewriter = nullptr;
-  bool inPlaceRewrite;
+  // Declarators sharing their decl-specifiers, constexpr is added to all of
+  // them or none
+  struct VarCandidate {
+    // Null for globals and static data members
+    clang::DeclStmt *stmt = nullptr;
+    llvm::SmallVector<clang::VarDecl *, 1> vars;
+    // The function the declaration is in, null for globals and static data
+    // members
+    clang::FunctionDecl *func = nullptr;
+    // Where constexpr goes
+    clang::SourceLocation loc;
+  };
 
-public:
-  FunctionDeclFrontendAction() : inPlaceRewrite(ConstExprFixItOption) {}
+  // The functions being traversed, innermost last. Only functions at a
+  // candidate location are tracked, the others are null.
+  std::vector<clang::FunctionDecl *> functions_;
+  // Lambdas entered within the innermost function
+  unsigned lambdas_ = 0;
+  // Canonical decls of functions whose body has a statement a constexpr
+  // function can't have
+  llvm::SmallPtrSet<const clang::FunctionDecl *, 16> rejectedStatements_;
 
-  std::unique_ptr<clang::ASTConsumer>
-  CreateASTConsumer(clang::CompilerInstance &CI,
-                    clang::StringRef file) override {
+  std::vector<Candidate> candidates_;
+  std::vector<VarCandidate> varCandidates_;
+  // How many global declarations start at each location
+  llvm::DenseMap<unsigned, unsigned> globalDeclarators_;
+  // Location of the global declarations to their candidate
+  llvm::DenseMap<unsigned, unsigned> globalCandidates_;
+  // Time spent evaluating candidates, for -eval-time-limit
+  std::chrono::steady_clock::duration evaluationTime_{};
+  // Canonical decl to the candidates for its redeclarations
+  llvm::DenseMap<const clang::FunctionDecl *, std::vector<unsigned>>
+      candidatesByDecl_;
+  // Canonical decl to the canonical decls of every function its body calls
+  llvm::DenseMap<const clang::FunctionDecl *,
+                 llvm::SmallPtrSet<const clang::FunctionDecl *, 8>>
+      calleesByDecl_;
+  // With -fold-calls, every call in a tracked function and that function,
+  // outer calls first
+  std::vector<std::pair<clang::CallExpr *, clang::FunctionDecl *>> calls_;
+  // With -strongest in C++20, every reference to a function with the tracked
+  // function it's in, and the calls those references are the callee of
+  using FunctionRef =
+      std::pair<const clang::DeclRefExpr *, const clang::FunctionDecl *>;
+  std::vector<FunctionRef> functionRefs_;
+  llvm::DenseMap<const clang::DeclRefExpr *, const clang::CallExpr *>
+      calleeRefs_;
+  // Functions named by a dependent call, which is only resolved in the
+  // instantiations of the template it's in
+  llvm::DenseSet<const clang::FunctionDecl *> unresolvedRefs_;
+  // With -classes, the class definitions at candidate locations
+  std::vector<const clang::CXXRecordDecl *> records_;
+  // With text output, the findings still to be reported as warnings and
+  // where
+  using Warning = std::pair<size_t, clang::SourceLocation>;
+  std::vector<Warning> warnings_;
+
+  // consteval and constinit only exist since C++20
+  bool strongestEnabled() const {
+    return StrongestOption && compat::isCPlusPlus20(sema_.getLangOpts());
+  }
 
-    if (inPlaceRewrite) {
-      ConstexprFixItOptions fixItOptions;
-      fixItOptions.InPlace = inPlaceRewrite;
+  // With -eval-time-limit, whether the TU used up its evaluation time
+  bool evaluationTimeSpent() const {
+    return EvalTimeLimitOption != 0 &&
+           evaluationTime_ >= std::chrono::milliseconds(EvalTimeLimitOption);
+  }
 
-      rewriter = std::make_unique<clang::FixItRewriter>(
-          CI.getDiagnostics(), CI.getASTContext().getSourceManager(),
-          CI.getASTContext().getLangOpts(), &fixItOptions);
+  // Counts the time spent in scope against the TU's evaluation budget
+  class EvaluationTimer {
+    std::chrono::steady_clock::duration &total_;
+    std::chrono::steady_clock::time_point start_;
 
-      CI.getDiagnostics().setClient(rewriter.get(), false);
+  public:
+    explicit EvaluationTimer(std::chrono::steady_clock::duration &total)
+        : total_(total) {
+      if (EvalTimeLimitOption)
+        start_ = std::chrono::steady_clock::now();
     }
 
-    return std::make_unique<ConstexprEverythingASTConsumer>(
-        CI); // pass CI pointer to ASTConsumer
-  }
+    ~EvaluationTimer() {
+      if (EvalTimeLimitOption)
+        total_ += std::chrono::steady_clock::now() - start_;
+    }
+  };
 
-  void EndSourceFileAction() override {
-    if (inPlaceRewrite)
-      rewriter->WriteFixedFiles();
+  // Where an insertion before loc goes in the file. Invalid if loc is inside
+  // a macro's definition, where it would change every expansion.
+  clang::SourceLocation insertionLoc(clang::SourceLocation loc) const {
+    return clang::Lexer::makeFileCharRange(
+               clang::CharSourceRange::getCharRange(loc, loc), sourceManager_,
+               sema_.getLangOpts())
+        .getBegin();
+  }
+
+  Finding makeFinding(Finding::Kind kind, const clang::NamedDecl *decl,
+                      clang::SourceLocation loc,
+                      const clang::FixItHint &FixIt) const {
+    // Record where the fix-it goes the same way the diagnostic consumer would
+    const clang::tooling::Replacement replacement(
+        sourceManager_, FixIt.RemoveRange, FixIt.CodeToInsert);
+    const auto spelling = sourceManager_.getSpellingLoc(loc);
+
+    Finding finding;
+    finding.kind = kind;
+    finding.File = replacement.getFilePath().str();
+    finding.Offset = replacement.getOffset();
+    finding.Line = sourceManager_.getSpellingLineNumber(spelling);
+    finding.Column = sourceManager_.getSpellingColumnNumber(spelling);
+    finding.Name = decl->getQualifiedNameAsString();
+    llvm::SmallString<128> usr;
+    if (!clang::index::generateUSRForDecl(decl, usr))
+      finding.USR = usr.str().str();
+    finding.FixIt = FixIt.CodeToInsert;
+    return finding;
+  }
+
+  // The mangled name a profile knows func by. Patterns have none, they're
+  // never emitted.
+  std::string symbolName(const clang::FunctionDecl *func) {
+    if (ProfileOption.empty() || !func || func->isTemplated())
+      return std::string();
+
+    if (!names_)
+      names_ = std::make_unique<compat::SymbolNameGenerator>(sema_.Context);
+    return names_->getName(func);
+  }
+
+  // executed is the function whose executions the finding saves work in,
+  // null for globals
+  void report(Finding::Kind kind, const clang::NamedDecl *decl,
+              clang::SourceLocation loc, const clang::FunctionDecl *executed,
+              bool removesDynamicInitializer = false,
+              llvm::StringRef specifier = "constexpr") {
+    // A finding is its fix-it, which can't be written into a macro
+    loc = insertionLoc(loc);
+    if (loc.isInvalid())
+      return;
+
+    const auto FixIt =
+        clang::FixItHint::CreateInsertion(loc, (specifier + " ").str());
+    Finding finding = makeFinding(kind, decl, loc, FixIt);
+    finding.RemovesDynamicInitializer = removesDynamicInitializer;
+    finding.Symbol = symbolName(executed);
+    finding.Shared = !sourceManager_.isWrittenInMainFile(loc);
+    const bool shared = finding.Shared;
+    findings_.push_back(std::move(finding));
+
+    // main() prints the shared ones once every TU is done
+    if (OutputFormatOption == OutputFormat::Text && !shared)
+      warnings_.emplace_back(findings_.size() - 1, loc);
+  }
+
+  // Renders the warnings in the order of their findings, not in the order
+  // the solver got to them
+  void reportWarnings() {
+    std::stable_sort(warnings_.begin(), warnings_.end(),
+                     [this](const Warning &a, const Warning &b) {
+                       return findingBefore(findings_[a.first],
+                                            findings_[b.first]);
+                     });
+
+    const auto ID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Warning,
+        "%0 can be %1%select{|, removing its dynamic initializer}2");
+    for (const auto &warning : warnings_) {
+      const auto &finding = findings_[warning.first];
+      DE.Report(warning.second, ID)
+          << Finding::name(finding.kind)
+          << llvm::StringRef(finding.FixIt).rtrim()
+          << finding.RemovesDynamicInitializer
+          << clang::FixItHint::CreateInsertion(warning.second, finding.FixIt);
+    }
+  }
+
+  // Records how an instantiation fared, at its pattern's location
+  void observe(const Candidate &candidate) {
+    const auto loc = insertionLoc(candidate.loc);
+    if (loc.isInvalid())
+      return;
+
+    const auto FixIt = clang::FixItHint::CreateInsertion(loc, "constexpr ");
+    Finding finding =
+        makeFinding(Finding::Instantiation,
+                    candidate.func->getTemplateInstantiationPattern(), loc,
+                    FixIt);
+
+    llvm::raw_string_ostream os(finding.Instantiation);
+    candidate.func->getNameForDiagnostic(
+        os, sema_.Context.getPrintingPolicy(), /*Qualified=*/true);
+    os.flush();
+    finding.Constant = candidate.verdict;
+    finding.Symbol = symbolName(candidate.func);
+    findings_.push_back(std::move(finding));
+  }
+
+  void rejectStatement() {
+    if (!functions_.empty() && functions_.back() && lambdas_ == 0)
+      rejectedStatements_.insert(functions_.back()->getCanonicalDecl());
+  }
+
+  // Rejects bodies that obviously can't be constant before Sema's checks
+  // rejectedCall is set if the only reason is a call
+  bool passesPreFilter(clang::FunctionDecl *func, bool &rejectedCall) {
+    PhaseTimer timer(stats_, Statistics::PreFilter, func);
+    if (rejectedStatements_.count(func->getCanonicalDecl())) {
+      stats_.count(Statistics::FunctionsRejectedStatement);
+      return false;
+    }
+
+    AlwaysEvaluatedScan scan(sourceManager_, sema_.getLangOpts());
+    if (auto reason = scan.scanBody(func->getBody())) {
+      stats_.count(*reason);
+      rejectedCall = *reason == Statistics::FunctionsRejectedCall;
+      return false;
+    }
+    return true;
+  }
+
+  void reportUndecided(clang::SourceLocation loc, llvm::StringRef what) {
+    const auto ID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Remark,
+        "%0 left undecided, constexpr evaluation budget exceeded");
+    DE.Report(loc, ID) << what;
+  }
+
+  // Runs an evaluation in the evaluator -interp asks for. With -interp=verify
+  // the bytecode interpreter runs first, on a clock of its own, and the
+  // classic evaluator has the final say.
+  template <typename Evaluation>
+  auto evaluate(Statistics::Phase phase, const clang::NamedDecl *decl,
+                clang::SourceLocation loc, Evaluation evaluation)
+      -> decltype(evaluation()) {
+    if (InterpOption != Interpreter::Verify) {
+      PhaseTimer timer(stats_, phase, decl);
+      EvaluationTimer budget(evaluationTime_);
+      return evaluation();
+    }
+
+    // Which evaluator runs is looked up on every evaluation
+    auto &langOpts = const_cast<clang::LangOptions &>(sema_.getLangOpts());
+    decltype(evaluation()) bytecode, classic;
+    compat::setBytecodeInterpreter(langOpts, true);
+    {
+      PhaseTimer timer(stats_, Statistics::BytecodeVerification, decl);
+      EvaluationTimer budget(evaluationTime_);
+      bytecode = evaluation();
+    }
+    compat::setBytecodeInterpreter(langOpts, false);
+    {
+      PhaseTimer timer(stats_, phase, decl);
+      EvaluationTimer budget(evaluationTime_);
+      classic = evaluation();
+    }
+
+    stats_.count(Statistics::EvaluatorVerdictsCompared);
+    if (bytecode != classic) {
+      stats_.count(Statistics::EvaluatorVerdictsDiffering);
+      const auto ID = DE.getCustomDiagID(
+          clang::DiagnosticsEngine::Remark,
+          "the bytecode interpreter and the classic evaluator disagree on %0");
+      DE.Report(loc, ID) << decl;
+    }
+    return classic;
+  }
+
+  // undecided is set if the evaluation ran out of budget before deciding,
+  // blocked if the only problem are calls to non-constexpr functions
+  bool canBeConstexpr(clang::FunctionDecl *func, bool &undecided,
+                      bool &blocked) {
+    auto &sema = sema_;
+    stats_.count(Statistics::FunctionsChecked);
+    blocked = false;
+
+    // A body the scan rejects for a call can't be constexpr, but whether the
+    // call is all that's wrong with it takes the remaining checks. Only the
+    // index and -classes tell blocked functions apart, so only they pay for
+    // that, and only with the call waived: the rejection is already counted.
+    bool rejectedCall = false;
+    if (func->getBody() && !passesPreFilter(func, rejectedCall) &&
+        !(rejectedCall && (!IndexDirOption.empty() || ClassesOption)))
+      return false;
+    auto reject = [&](Statistics::Counter counter) {
+      if (!rejectedCall)
+        stats_.count(counter);
+      return false;
+    };
+
+    // Temporarily disable diagnostics for these next functions, use a
+    // unique_ptr deleter to handle restoring it
+    sema.getDiagnostics().setSuppressAllDiagnostics(true);
+    {
+      PhaseTimer timer(stats_, Statistics::SemaChecks, func);
+      auto returnDiagnostics = [&sema](int *) {
+        sema.getDiagnostics().setSuppressAllDiagnostics(false);
+      };
+      int lol = 0;
+      std::unique_ptr<int, decltype(returnDiagnostics)> scope(
+          &lol, returnDiagnostics);
+
+      // Cheapest checks first. We can't check anything without a body, the
+      // signature's types are mostly answered from the cache and only then
+      // do the definition checks walk the whole body.
+      if (!func->getBody())
+        return reject(Statistics::FunctionsRejectedNoBody);
+
+      if (!isa<CXXConstructorDecl>(func) &&
+          !literalTypes_.isLiteral(func->getReturnType(),
+                                   func->getLocation()))
+        return reject(Statistics::FunctionsRejectedReturnType);
+
+      for (const auto *param : func->parameters())
+        if (!literalTypes_.isLiteral(param->getType(), param->getLocation()))
+          return reject(Statistics::FunctionsRejectedParameterTypes);
+
+      if (!compat::checkConstexprFunction(sema, func))
+        return reject(Statistics::FunctionsRejectedSema);
+    }
+
+    // A function rejected for a call is decided either way, it's only left
+    // not known to be blocked
+    if (evaluationTimeSpent()) {
+      undecided = !rejectedCall;
+      return false;
+    }
+
+    SmallVector<PartialDiagnosticAt, 8> Diags;
+    if (!evaluate(Statistics::PotentialConstantExpr, func, func->getLocation(),
+                  [&] {
+                    Diags.clear();
+                    return Expr::isPotentialConstantExpr(func, Diags);
+                  })) {
+      if (hitEvaluationLimit(Diags)) {
+        undecided = !rejectedCall;
+      } else {
+        reject(Statistics::FunctionsRejectedNotConstant);
+        blocked = onlyBlockedByCalls(Diags);
+      }
+      return false;
+    }
+
+    // The call the scan found is always evaluated, whatever the evaluator
+    // made of it
+    blocked = rejectedCall;
+    return !rejectedCall;
+  }
+
+  // Post-order over the call graph, so callees come before their callers
+  void orderCallees(unsigned index, std::vector<bool> &visited,
+                    std::vector<unsigned> &order) {
+    if (visited[index])
+      return;
+    visited[index] = true;
+
+    auto callees =
+        calleesByDecl_.find(candidates_[index].func->getCanonicalDecl());
+    if (callees != calleesByDecl_.end()) {
+      for (const auto *callee : callees->second) {
+        auto it = candidatesByDecl_.find(callee);
+        if (it == candidatesByDecl_.end())
+          continue;
+        for (auto calleeIndex : it->second)
+          orderCallees(calleeIndex, visited, order);
+      }
+    }
+
+    order.push_back(index);
+  }
+
+  void solveFunctions() {
+    std::vector<bool> visited(candidates_.size(), false);
+    std::vector<unsigned> order;
+    for (unsigned i = 0; i < candidates_.size(); ++i)
+      orderCallees(i, visited, order);
+
+    // Who calls each candidate, to know what to re-check when it flips
+    llvm::DenseMap<const clang::FunctionDecl *, std::vector<unsigned>> callers;
+    for (unsigned i = 0; i < candidates_.size(); ++i) {
+      auto callees =
+          calleesByDecl_.find(candidates_[i].func->getCanonicalDecl());
+      if (callees == calleesByDecl_.end())
+        continue;
+      for (const auto *callee : callees->second)
+        callers[callee].push_back(i);
+    }
+
+    // Instantiations go last and are only constexpr while they're checked.
+    // Whether their pattern gets marked depends on every instantiation in
+    // the run, so nothing outside of them can rely on it.
+    solveWorklist(order, callers, /*instantiations=*/false);
+    if (TemplatesOption) {
+      solveWorklist(order, callers, /*instantiations=*/true);
+      for (auto &candidate : candidates_)
+        if (candidate.instantiation && candidate.verdict)
+          candidate.func->setConstexprKind(compat::ConstexprKind::Unspecified);
+    }
+
+    if (strongestEnabled())
+      decideConsteval();
+
+    // Report in source order once the verdicts are final
+    for (const auto &candidate : candidates_) {
+      if (candidate.instantiation) {
+        if (!candidate.undecided) {
+          if (candidate.verdict)
+            stats_.count(Statistics::InstantiationsAccepted);
+          observe(candidate);
+        }
+        continue;
+      }
+
+      // Another TU beat us to it and already reported this one
+      if (candidate.shared &&
+          !candidateCache().insert(candidate.key, candidate.verdict)) {
+        stats_.count(Statistics::DeclsLeftToAnotherTU);
+        continue;
+      }
+
+      if (candidate.undecided) {
+        stats_.count(Statistics::FunctionsUndecided);
+        reportUndecided(candidate.loc, "function");
+        continue;
+      }
+
+      if (!candidate.verdict)
+        continue;
+
+      stats_.count(Statistics::FunctionsAccepted);
+      if (candidate.consteval)
+        stats_.count(Statistics::FunctionsConsteval);
+      report(Finding::Function, candidate.func, candidate.loc, candidate.func,
+             /*removesDynamicInitializer=*/false,
+             candidate.consteval ? "consteval" : "constexpr");
+    }
+
+    if (index_)
+      recordIndex();
+  }
+
+  // Whether call is a constant expression by itself
+  bool isConstantCall(const clang::CallExpr *call) {
+    if (call->isValueDependent() || call->isTypeDependent() ||
+        !compat::isPRValue(call) || evaluationTimeSpent())
+      return false;
+
+    return evaluate(Statistics::CallEvaluation, call->getDirectCallee(),
+                    call->getBeginLoc(), [&] {
+                      clang::Expr::EvalResult result;
+                      SmallVector<PartialDiagnosticAt, 8> notes;
+                      result.Diag = &notes;
+                      return call->EvaluateAsRValue(
+                                 result, sema_.Context,
+                                 /*InConstantContext=*/true) &&
+                             !result.HasSideEffects && notes.empty();
+                    });
+  }
+
+  // A function made constexpr can be consteval if every use of it is a call
+  // that is a constant expression on its own, an immediate invocation, or
+  // within its own body. That only says something about functions no other
+  // TU can call: ones with internal linkage, or inline ones in the main file.
+  // Members are left alone, since they can also be named through an object.
+  void decideConsteval() {
+    // Canonical decl to whether every use so far qualifies
+    llvm::DenseMap<const clang::FunctionDecl *, bool> constantUses;
+    for (const auto *callee : unresolvedRefs_)
+      constantUses[callee] = false;
+
+    for (const auto &ref : functionRefs_) {
+      const auto *callee =
+          cast<clang::FunctionDecl>(ref.first->getDecl())->getCanonicalDecl();
+      if (!isAccepted(callee))
+        continue;
+
+      auto &constant = constantUses.try_emplace(callee, true).first->second;
+      if (!constant ||
+          (ref.second && ref.second->getCanonicalDecl() == callee))
+        continue;
+
+      auto call = calleeRefs_.find(ref.first);
+      constant = call != calleeRefs_.end() && isConstantCall(call->second);
+    }
+
+    for (auto &candidate : candidates_) {
+      const auto *func = candidate.func;
+      if (!candidate.verdict || candidate.instantiation ||
+          isa<clang::CXXMethodDecl>(func) ||
+          !sourceManager_.isWrittenInMainFile(candidate.loc) ||
+          (func->isExternallyVisible() && !func->isInlined()))
+        continue;
+
+      auto it = constantUses.find(func->getCanonicalDecl());
+      candidate.consteval = it != constantUses.end() && it->second;
+    }
+  }
+
+  // Why func isn't constexpr, as the select of the -classes note
+  enum Rejection { NotChecked, Rejected, BlockedByCalls, Undecided };
+
+  Rejection rejection(const clang::FunctionDecl *func) const {
+    auto it = candidatesByDecl_.find(func->getCanonicalDecl());
+    if (it == candidatesByDecl_.end())
+      return NotChecked;
+
+    auto reason = Rejected;
+    for (auto index : it->second) {
+      if (candidates_[index].undecided)
+        return Undecided;
+      if (candidates_[index].blocked)
+        reason = BlockedByCalls;
+    }
+    return reason;
+  }
+
+  // How many of the functions rejected only because of their calls call no
+  // function that isn't constexpr outside of a single class, by class
+  llvm::DenseMap<const clang::CXXRecordDecl *, unsigned>
+  waitingOnClasses() const {
+    llvm::DenseMap<const clang::CXXRecordDecl *, unsigned> waiting;
+    llvm::SmallPtrSet<const clang::FunctionDecl *, 16> counted;
+    for (const auto &candidate : candidates_) {
+      const auto *func = candidate.func->getCanonicalDecl();
+      if (!candidate.blocked || candidate.instantiation || isAccepted(func) ||
+          !counted.insert(func).second)
+        continue;
+
+      auto callees = calleesByDecl_.find(func);
+      if (callees == calleesByDecl_.end())
+        continue;
+
+      const clang::CXXRecordDecl *only = nullptr;
+      bool single = true;
+      for (const auto *callee : callees->second) {
+        if (callee == func || isConstexprNow(callee))
+          continue;
+        const auto *method = clang::dyn_cast<clang::CXXMethodDecl>(callee);
+        const auto *record =
+            method ? method->getParent()->getCanonicalDecl() : nullptr;
+        if (!record || (only && record != only)) {
+          single = false;
+          break;
+        }
+        only = record;
+      }
+      if (single && only)
+        ++waiting[only];
+    }
+    return waiting;
+  }
+
+  // With -classes, once the member verdicts are final, explains what keeps
+  // each class from being used in constant expressions: whatever makes it a
+  // non-literal type, and the special members that aren't constexpr, without
+  // which its values can't be created, copied or assigned at compile time.
+  // The count is of this TU's functions that only wait on the class.
+  void solveClasses() {
+    auto &context = sema_.Context;
+    const auto remarkID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Remark,
+        "%0 can't be used in constant expressions%select{|, which keeps %2 "
+        "function%s2 from being constexpr}1");
+    const auto functionID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Note,
+        "%0 %select{isn't constexpr|can't be constexpr|can't be constexpr "
+        "while the functions it calls aren't|was left undecided}1");
+    const auto typeID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Note,
+        "%select{base class|field %2}0 has the non-literal type %1");
+    const auto destructorID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Note, "%0 isn't trivial");
+    const auto constructorID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Note,
+        "no constructor other than the copy and move constructors is "
+        "constexpr");
+
+    // Classes and functions are DeclContexts too, which streams differently
+    auto named = [](const clang::NamedDecl *decl) { return decl; };
+
+    const auto waiting = waitingOnClasses();
+    for (const auto *record : records_) {
+      // Classes in headers only need to be explained by the first TU
+      CandidateCache::Key key;
+      if (getSharedCandidateKey(sourceManager_, record, record->getBeginLoc(),
+                                key) &&
+          !candidateCache().claim(key)) {
+        stats_.count(Statistics::DeclsLeftToAnotherTU);
+        continue;
+      }
+      stats_.count(Statistics::ClassesChecked);
+
+      std::vector<std::function<void()>> notes;
+      llvm::SmallPtrSet<const clang::FunctionDecl *, 8> noted;
+      auto noteFunction = [&](const clang::CXXMethodDecl *func) {
+        if (!func->isUserProvided() || isConstexprNow(func) ||
+            !noted.insert(func).second)
+          return;
+        notes.push_back([&, func] {
+          DE.Report(func->getLocation(), functionID)
+              << named(func) << static_cast<unsigned>(rejection(func));
+        });
+      };
+
+      if (!isLiteralAfterPromotion(context, context.getRecordType(record))) {
+        for (const auto &base : record->bases())
+          if (!isLiteralAfterPromotion(context, base.getType()))
+            notes.push_back([&, base] {
+              DE.Report(base.getBeginLoc(), typeID)
+                  << 0 << base.getType() << named(record);
+            });
+        for (const auto *field : record->fields())
+          if (field->getType().isVolatileQualified() ||
+              !isLiteralAfterPromotion(context, field->getType()))
+            notes.push_back([&, field] {
+              DE.Report(field->getLocation(), typeID)
+                  << 1 << field->getType() << named(field);
+            });
+
+        const auto *destructor = record->getDestructor();
+        if (!record->hasTrivialDestructor() && destructor &&
+            destructor->isUserProvided() && !destructor->isConstexpr())
+          notes.push_back([&, destructor] {
+            DE.Report(destructor->getLocation(), destructorID)
+                << named(destructor);
+          });
+
+        if (!isConstructibleInConstantExpressions(record)) {
+          notes.push_back([&, record] {
+            DE.Report(record->getLocation(), constructorID);
+          });
+          for (const auto *ctor : record->ctors())
+            if (!ctor->isCopyOrMoveConstructor())
+              noteFunction(ctor);
+        }
+      }
+
+      for (const auto *ctor : record->ctors())
+        if (ctor->isDefaultConstructor() || ctor->isCopyOrMoveConstructor())
+          noteFunction(ctor);
+      for (const auto *method : record->methods())
+        if (method->isCopyAssignmentOperator() ||
+            method->isMoveAssignmentOperator())
+          noteFunction(method);
+
+      if (notes.empty())
+        continue;
+
+      stats_.count(Statistics::ClassesNotUsable);
+      auto it = waiting.find(record->getCanonicalDecl());
+      const unsigned count = it == waiting.end() ? 0 : it->second;
+      DE.Report(record->getLocation(), remarkID)
+          << named(record) << (count != 0) << count;
+      for (const auto &note : notes)
+        note();
+    }
+  }
+
+  void solveWorklist(
+      const std::vector<unsigned> &order,
+      const llvm::DenseMap<const clang::FunctionDecl *, std::vector<unsigned>>
+          &callers,
+      bool instantiations) {
+    std::deque<unsigned> worklist;
+    std::vector<bool> queued(candidates_.size(), false);
+    for (auto index : order) {
+      if (candidates_[index].instantiation == instantiations) {
+        worklist.push_back(index);
+        queued[index] = true;
+      }
+    }
+
+    while (!worklist.empty()) {
+      auto index = worklist.front();
+      worklist.pop_front();
+      queued[index] = false;
+
+      auto &candidate = candidates_[index];
+      if (candidate.verdict || candidate.undecided ||
+          !canBeConstexpr(candidate.func, candidate.undecided,
+                          candidate.blocked))
+        continue;
+
+      // Mark function as constexpr, the callers and the variables will use
+      // this information
+      candidate.verdict = true;
+      candidate.func->setConstexprKind(compat::ConstexprKind::Constexpr);
+
+      auto it = callers.find(candidate.func->getCanonicalDecl());
+      if (it == callers.end())
+        continue;
+      for (auto caller : it->second) {
+        const auto &entry = candidates_[caller];
+        if (entry.instantiation == instantiations && !entry.verdict &&
+            !entry.undecided && !queued[caller]) {
+          queued[caller] = true;
+          worklist.push_back(caller);
+        }
+      }
+    }
+  }
+
+  void recordIndex() {
+    for (const auto &candidate : candidates_) {
+      const auto *func = candidate.func;
+      if (!func->doesThisDeclarationHaveABody() || candidate.undecided ||
+          candidate.instantiation)
+        continue;
+
+      IndexedFunction entry;
+      llvm::SmallString<128> usr;
+      if (clang::index::generateUSRForDecl(func, usr))
+        continue;
+      entry.USR = usr.str().str();
+      entry.Name = func->getQualifiedNameAsString();
+
+      const auto loc = sourceManager_.getFileLoc(candidate.loc);
+      entry.File = sourceManager_.getFilename(loc).str();
+      entry.Line = sourceManager_.getSpellingLineNumber(loc);
+      entry.Flags =
+          (candidate.verdict ? IndexedFunction::Constexpr : 0) |
+          (candidate.blocked ? IndexedFunction::BlockedByCalls : 0) |
+          (sourceManager_.isWrittenInMainFile(loc) ? IndexedFunction::InMainFile
+                                                   : 0);
+
+      const auto *method = clang::dyn_cast<clang::CXXMethodDecl>(func);
+      usr.clear();
+      if (method && !method->getParent()->isLambda() &&
+          !clang::index::generateUSRForDecl(method->getParent(), usr)) {
+        entry.Record = usr.str().str();
+        entry.RecordName = method->getParent()->getQualifiedNameAsString();
+      }
+
+      auto callees = calleesByDecl_.find(func->getCanonicalDecl());
+      if (callees != calleesByDecl_.end()) {
+        for (const auto *callee : callees->second) {
+          IndexedFunction::Callee indexed;
+          usr.clear();
+          if (clang::index::generateUSRForDecl(callee, usr))
+            continue;
+          indexed.USR = usr.str().str();
+
+          // Verdicts are set on the definition, not the canonical decl
+          const clang::FunctionDecl *definition = nullptr;
+          const bool defined = callee->isDefined(definition);
+          indexed.Flags =
+              ((defined ? definition : callee)->isConstexpr()
+                   ? IndexedFunction::Callee::Constexpr
+                   : 0) |
+              (defined ? IndexedFunction::Callee::Defined : 0);
+          entry.Callees.push_back(std::move(indexed));
+        }
+      }
+
+      index_->push_back(std::move(entry));
+    }
+  }
+
+  // Whether this TU made func constexpr
+  bool isAccepted(const clang::FunctionDecl *func) const {
+    auto it = candidatesByDecl_.find(func->getCanonicalDecl());
+    return it != candidatesByDecl_.end() &&
+           llvm::any_of(it->second, [this](unsigned index) {
+             return candidates_[index].verdict &&
+                    !candidates_[index].instantiation;
+           });
+  }
+
+  // Whether stmt calls a function or a constructor at all
+  static bool containsCall(const clang::Stmt *stmt) {
+    if (!stmt)
+      return false;
+
+    if (isa<clang::CallExpr>(stmt) || isa<clang::CXXConstructExpr>(stmt))
+      return true;
+
+    return llvm::any_of(stmt->children(), containsCall);
+  }
+
+  // Whether stmt calls a function this TU made constexpr
+  bool callsAcceptedFunction(const clang::Stmt *stmt) const {
+    if (!stmt)
+      return false;
+
+    const clang::FunctionDecl *callee = nullptr;
+    if (const auto *call = clang::dyn_cast<clang::CallExpr>(stmt))
+      callee = call->getDirectCallee();
+    else if (const auto *construct =
+                 clang::dyn_cast<clang::CXXConstructExpr>(stmt))
+      callee = construct->getConstructor();
+
+    if (callee && isAccepted(callee))
+      return true;
+
+    return llvm::any_of(stmt->children(), [this](const clang::Stmt *child) {
+      return callsAcceptedFunction(child);
+    });
+  }
+
+  enum class VariableVerdict { Constant, NotConstant, Undecided };
+
+  VariableVerdict evaluateVariable(clang::VarDecl *var, bool callsAccepted) {
+    stats_.count(Statistics::VariablesEvaluated);
+
+    // Does the init function use dependent values
+    if (var->getInit()->isValueDependent())
+      return VariableVerdict::NotConstant;
+
+    // The value each evaluator computes is cached on the decl
+    const bool forget = callsAccepted || InterpOption == Interpreter::Verify;
+    return evaluate(Statistics::VariableEvaluation, var, var->getLocation(),
+                    [&] {
+                      if (forget)
+                        compat::forgetEvaluation(var);
+
+                      // Can we evaluate the value
+                      SmallVector<PartialDiagnosticAt, 8> Notes;
+                      if (compat::hasConstantInitializer(var, Notes))
+                        return VariableVerdict::Constant;
+                      return hitEvaluationLimit(Notes)
+                                 ? VariableVerdict::Undecided
+                                 : VariableVerdict::NotConstant;
+                    });
+  }
+
+  void solveVariable(const VarCandidate &candidate) {
+    // Don't go through functions that are already constexpr
+    if (candidate.func && candidate.func->isConstexpr())
+      return;
+
+    clang::SourceLocation loc = candidate.loc;
+
+    // Some of the declarators sharing the specifiers aren't candidates
+    if (!candidate.func &&
+        globalDeclarators_[loc.getRawEncoding()] != candidate.vars.size())
+      return;
+
+    // Variables in headers only need to be checked by the first TU
+    CandidateCache::Key key;
+    if (getSharedCandidateKey(sourceManager_, candidate.vars.front(), loc,
+                              key) &&
+        !candidateCache().claim(key)) {
+      stats_.count(Statistics::DeclsLeftToAnotherTU);
+      return;
+    }
+
+    if (evaluationTimeSpent()) {
+      stats_.count(Statistics::VariablesUndecided);
+      reportUndecided(loc, "variable");
+      return;
+    }
+
+    // Any literal type will do, not just integral ones. A global that can't
+    // be constexpr can still have its constant initialization enforced.
+    const bool canBeConstexpr =
+        llvm::all_of(candidate.vars, [this](const clang::VarDecl *var) {
+          return var->getType().isConstQualified() &&
+                 isLiteralAfterPromotion(sema_.Context, var->getType());
+        });
+    if (!canBeConstexpr && (candidate.func || !strongestEnabled())) {
+      stats_.count(Statistics::VariablesRejectedNonLiteral);
+      return;
+    }
+
+    // A constant initializer that calls a function only made constexpr by
+    // this run couldn't be evaluated before, so it was a dynamic initializer
+    unsigned dynamic = 0;
+    for (auto *var : candidate.vars) {
+      const bool callsAccepted = callsAcceptedFunction(var->getInit());
+      switch (evaluateVariable(var, callsAccepted)) {
+      case VariableVerdict::Constant:
+        break;
+      case VariableVerdict::Undecided:
+        stats_.count(Statistics::VariablesUndecided);
+        reportUndecided(loc, "variable");
+        return;
+      case VariableVerdict::NotConstant:
+        return;
+      }
+      if (callsAccepted)
+        ++dynamic;
+    }
+
+    for (unsigned i = 0; i < candidate.vars.size(); ++i)
+      stats_.count(candidate.func ? Statistics::VariablesAccepted
+                   : canBeConstexpr ? Statistics::GlobalsAccepted
+                                    : Statistics::GlobalsConstinit);
+    if (!candidate.func)
+      for (unsigned i = 0; i < dynamic; ++i)
+        stats_.count(Statistics::DynamicInitializersRemoved);
+
+    report(Finding::Variable, candidate.vars.front(), loc, candidate.func,
+           !candidate.func && dynamic != 0,
+           canBeConstexpr ? "constexpr" : "constinit");
+  }
+
+  // The whitespace the line of loc starts with
+  std::string indentationAt(clang::SourceLocation loc) const {
+    auto decomposed = sourceManager_.getDecomposedLoc(loc);
+    bool invalid = false;
+    llvm::StringRef buffer =
+        sourceManager_.getBufferData(decomposed.first, &invalid);
+    if (invalid)
+      return std::string();
+
+    auto lineStart = buffer.rfind('\n', decomposed.second);
+    lineStart = lineStart == llvm::StringRef::npos ? 0 : lineStart + 1;
+    return buffer.slice(lineStart, decomposed.second)
+        .take_while([](char c) { return c == ' ' || c == '\t'; })
+        .str();
+  }
+
+  // Whether stmt refers to a variable declared at or after loc
+  bool referencesLaterDecls(const clang::Stmt *stmt,
+                            clang::SourceLocation loc) const {
+    if (!stmt)
+      return false;
+
+    if (const auto *ref = clang::dyn_cast<clang::DeclRefExpr>(stmt))
+      if (isa<clang::VarDecl>(ref->getDecl()) &&
+          !sourceManager_.isBeforeInTranslationUnit(
+              ref->getDecl()->getLocation(), loc))
+        return true;
+
+    return llvm::any_of(stmt->children(), [&](const clang::Stmt *child) {
+      return referencesLaterDecls(child, loc);
+    });
+  }
+
+  // Calls to the functions this TU made constexpr whose arguments are all
+  // constant. Nothing makes the compiler evaluate them at compile time, but
+  // a constexpr variable holding the result would. The fix-its declare one
+  // right before the statement and use it instead of the call; they're
+  // attached to remarks, which -fix doesn't apply, since the rewrite is
+  // intrusive and a new name could still shadow another.
+  void solveCalls() {
+    auto &context = sema_.Context;
+    const auto &langOpts = sema_.getLangOpts();
+    const auto ID = DE.getCustomDiagID(
+        clang::DiagnosticsEngine::Remark,
+        "call to %0 can be evaluated at compile time by a constexpr variable");
+
+    llvm::SmallPtrSet<const clang::Stmt *, 16> folded;
+    std::map<std::pair<const clang::FunctionDecl *, std::string>, unsigned>
+        names;
+    for (const auto &entry : calls_) {
+      // Nothing depends on these, they're just left unreported
+      if (evaluationTimeSpent())
+        return;
+
+      clang::CallExpr *call = entry.first;
+      const clang::FunctionDecl *func = entry.second;
+      const auto *callee = call->getDirectCallee();
+      if (!callee || !callee->getIdentifier() || !isAccepted(callee) ||
+          call->getBeginLoc().isMacroID() || call->getType()->isVoidType())
+        continue;
+
+      // A C++11 constexpr body can only be a return statement
+      if (func->isConstexpr() && !langOpts.CPlusPlus14)
+        continue;
+
+      // Find the statement of the enclosing block the call is in, giving up
+      // on contexts that are constant already or not evaluated at all
+      const clang::Stmt *statement = call;
+      const clang::CompoundStmt *block = nullptr;
+      bool skip = false;
+      auto parents = context.getParents(*call);
+      while (!parents.empty() && !skip) {
+        const auto &parent = parents[0];
+        block = parent.get<clang::CompoundStmt>();
+        if (block)
+          break;
+
+        if (const auto *var = parent.get<clang::VarDecl>()) {
+          // Constant already, or for the variable pass to make constexpr
+          skip = var->isConstexpr() || var->getType().isConstQualified();
+          parents = context.getParents(*var);
+          continue;
+        }
+
+        const auto *stmt = parent.get<clang::Stmt>();
+        skip = !stmt || folded.count(stmt) || isa<clang::ConstantExpr>(stmt) ||
+               isa<clang::UnaryExprOrTypeTraitExpr>(stmt) ||
+               isa<clang::CXXNoexceptExpr>(stmt) ||
+               isa<clang::CXXTypeidExpr>(stmt);
+        statement = stmt;
+        parents = context.getParents(*stmt);
+      }
+
+      // An unused result is dead code already, and jumps must not bypass
+      // the new declaration
+      if (skip || !block || statement == call ||
+          isa<clang::SwitchCase>(statement) ||
+          isa<clang::LabelStmt>(statement) ||
+          statement->getBeginLoc().isMacroID() ||
+          referencesLaterDecls(call, statement->getBeginLoc()))
+        continue;
+
+      if (!isConstantCall(call))
+        continue;
+
+      auto callText = clang::Lexer::getSourceText(
+          clang::CharSourceRange::getTokenRange(call->getSourceRange()),
+          sourceManager_, langOpts);
+      if (callText.empty())
+        continue;
+
+      std::string name = callee->getName().str() + "_value";
+      if (unsigned uses = names[{func, name}]++)
+        name += std::to_string(uses + 1);
+
+      folded.insert(call);
+      stats_.count(Statistics::CallsFolded);
+      DE.Report(call->getBeginLoc(), ID)
+          << callee
+          << clang::FixItHint::CreateInsertion(
+                 statement->getBeginLoc(),
+                 "constexpr auto " + name + " = " + callText.str() + ";\n" +
+                     indentationAt(statement->getBeginLoc()))
+          << clang::FixItHint::CreateReplacement(call->getSourceRange(), name);
+    }
+  }
+
+public:
+  // Instantiations are traversed like any other function with -templates
+  bool shouldVisitTemplateInstantiations() const { return TemplatesOption; }
+
+  explicit ConstexprEverythingASTVisitor(clang::Sema &sema, Statistics &stats,
+                                         std::vector<Finding> &findings,
+                                         std::vector<IndexedFunction> *index)
+      : sourceManager_(sema.getSourceManager()), sema_(sema),
+        DE(sema.getDiagnostics()), stats_(stats), findings_(findings),
+        index_(index), literalTypes_(sema, stats) {}
+
+  // Keep track of the function we're in so calls and declarations can be
+  // attributed to it
+  bool TraverseDecl(clang::Decl *decl) {
+    auto *func = clang::dyn_cast_or_null<clang::FunctionDecl>(decl);
+    if (!func)
+      return Base::TraverseDecl(decl);
+
+    const bool tracked = isCandidateLocation(
+        sourceManager_, func->getSourceRange().getBegin());
+    functions_.push_back(tracked ? func : nullptr);
+    const auto lambdas = lambdas_;
+    lambdas_ = 0;
+    const bool result = Base::TraverseDecl(decl);
+    lambdas_ = lambdas;
+    functions_.pop_back();
+    return result;
+  }
+
+  // Lambda bodies are traversed as part of the enclosing function, but what
+  // they contain doesn't disqualify it
+  bool TraverseLambdaExpr(clang::LambdaExpr *lambda,
+                          DataRecursionQueue *queue = nullptr) {
+    ++lambdas_;
+    const bool result = Base::TraverseLambdaExpr(lambda, queue);
+    --lambdas_;
+    return result;
+  }
+
+  // Statements a constexpr body can't contain, found during the traversal
+  // so the pre-filter doesn't have to look for them. asm and try blocks are
+  // allowed from C++20 on.
+  bool VisitAsmStmt(clang::AsmStmt *) {
+    if (!compat::isCPlusPlus20(sema_.getLangOpts()))
+      rejectStatement();
+    return true;
+  }
+
+  bool VisitCXXTryStmt(clang::CXXTryStmt *) {
+    if (!compat::isCPlusPlus20(sema_.getLangOpts()))
+      rejectStatement();
+    return true;
+  }
+
+  bool VisitGotoStmt(clang::GotoStmt *) {
+    rejectStatement();
+    return true;
+  }
+
+  bool VisitIndirectGotoStmt(clang::IndirectGotoStmt *) {
+    rejectStatement();
+    return true;
+  }
+
+  bool VisitFunctionDecl(clang::FunctionDecl *func) {
+    stats_.count(Statistics::FunctionsVisited);
+
+    // Only functions in our TU, or headers if requested
+    SourceLocation loc = func->getSourceRange().getBegin();
+    if (!isCandidateLocation(sourceManager_, loc)) {
+      stats_.count(Statistics::FunctionsNotCandidateLocation);
+      return true;
+    }
+
+    // Skip existing constExpr functions
+    if (func->isConstexpr()) {
+      stats_.count(Statistics::FunctionsAlreadyConstexpr);
+      return true;
+    }
+
+    // Don't mark main as constexpr
+    if (func->isMain()) {
+      stats_.count(Statistics::FunctionsMain);
+      return true;
+    }
+
+    // Destructors can't be constexpr
+    if (isa<CXXDestructorDecl>(func)) {
+      stats_.count(Statistics::FunctionsDestructor);
+      return true;
+    }
+
+    Candidate candidate;
+    candidate.func = func;
+    candidate.loc = loc;
+
+    // With -templates the patterns are decided from their instantiations.
+    // Only instantiations whose body was needed say anything about it.
+    if (TemplatesOption && func->isTemplated()) {
+      stats_.count(Statistics::FunctionsTemplatePattern);
+      return true;
+    }
+    if (TemplatesOption && func->isTemplateInstantiation()) {
+      if (!func->doesThisDeclarationHaveABody())
+        return true;
+
+      stats_.count(Statistics::InstantiationsChecked);
+      candidate.instantiation = true;
+      candidatesByDecl_[func->getCanonicalDecl()].push_back(candidates_.size());
+      candidates_.push_back(std::move(candidate));
+      return true;
+    }
+
+    // Header functions might already have been checked by another TU
+    candidate.shared =
+        getSharedCandidateKey(sourceManager_, func, loc, candidate.key);
+    if (candidate.shared) {
+      if (auto verdict = candidateCache().lookup(candidate.key)) {
+        stats_.count(Statistics::FunctionsCachedVerdict);
+        if (*verdict)
+          func->setConstexprKind(compat::ConstexprKind::Constexpr);
+        return true;
+      }
+    }
+
+    candidatesByDecl_[func->getCanonicalDecl()].push_back(candidates_.size());
+    candidates_.push_back(std::move(candidate));
+
+    return true;
+  }
+
+  bool VisitCXXRecordDecl(clang::CXXRecordDecl *record) {
+    if (!ClassesOption || !record->isThisDeclarationADefinition() ||
+        record->isImplicit() || record->isLambda() ||
+        !record->getIdentifier())
+      return true;
+
+    // Templates can only be told about per instantiation, and the members
+    // of instantiations are decided with their patterns
+    if (record->isDependentContext() ||
+        isa<clang::ClassTemplateSpecializationDecl>(record))
+      return true;
+
+    if (isCandidateLocation(sourceManager_, record->getBeginLoc()))
+      records_.push_back(record);
+    return true;
+  }
+
+  bool VisitCallExpr(clang::CallExpr *call) {
+    if (strongestEnabled())
+      if (const auto *ref = clang::dyn_cast<clang::DeclRefExpr>(
+              call->getCallee()->IgnoreParenImpCasts()))
+        calleeRefs_[ref] = call;
+
+    if (functions_.empty() || !functions_.back())
+      return true;
+
+    if (auto *callee = call->getDirectCallee())
+      calleesByDecl_[functions_.back()->getCanonicalDecl()].insert(
+          callee->getCanonicalDecl());
+
+    // Instantiations share the pattern's calls
+    if (FoldCallsOption && !functions_.back()->isTemplateInstantiation())
+      calls_.emplace_back(call, functions_.back());
+    return true;
+  }
+
+  bool VisitCXXConstructExpr(clang::CXXConstructExpr *construct) {
+    if (functions_.empty() || !functions_.back())
+      return true;
+
+    calleesByDecl_[functions_.back()->getCanonicalDecl()].insert(
+        construct->getConstructor()->getCanonicalDecl());
+    return true;
+  }
+
+  bool VisitDeclRefExpr(clang::DeclRefExpr *ref) {
+    if (strongestEnabled() && isa<clang::FunctionDecl>(ref->getDecl()))
+      functionRefs_.emplace_back(
+          ref, functions_.empty() ? nullptr : functions_.back());
+    return true;
+  }
+
+  bool VisitOverloadExpr(clang::OverloadExpr *overloads) {
+    if (!strongestEnabled())
+      return true;
+
+    for (const auto *decl : overloads->decls()) {
+      const auto *func = decl->getAsFunction();
+      if (func)
+        unresolvedRefs_.insert(func->getCanonicalDecl());
+    }
+    return true;
+  }
+
+  // Only the cheap syntactic checks happen here, the evaluation is deferred
+  // until the function verdicts are final
+  bool VisitDeclStmt(clang::DeclStmt *stmt) {
+    // Only functions in our TU, or headers if requested
+    if (functions_.empty() || !functions_.back())
+      return true;
+
+    // Every instantiation shares the pattern's declarations
+    if (functions_.back()->isTemplateInstantiation())
+      return true;
+
+    // constexpr is a decl-specifier, so every declarator has to qualify
+    VarCandidate candidate;
+    for (auto *decl : stmt->decls()) {
+      // Structured bindings can't be constexpr
+      auto *var = clang::dyn_cast<clang::VarDecl>(decl);
+      if (!var || isa<clang::DecompositionDecl>(var))
+        return true;
+
+      // Skip variables that are already constexpr
+      if (var->isConstexpr())
+        return true;
+
+      // Globals and static data members are found by VisitVarDecl, static
+      // locals aren't handled
+      if (!var->hasLocalStorage())
+        return true;
+
+      // var needs an initializer
+      if (!var->getInit())
+        return true;
+
+      // If the var is const we can mark it constexpr
+      QualType ty = var->getType();
+      if (!ty.isConstQualified())
+        return true;
+
+      candidate.vars.push_back(var);
+    }
+
+    for (unsigned i = 0; i < candidate.vars.size(); ++i)
+      stats_.count(Statistics::VariablesVisited);
+
+    candidate.stmt = stmt;
+    candidate.func = functions_.back();
+    candidate.loc = stmt->getSourceRange().getBegin();
+    varCandidates_.push_back(candidate);
+
+    return true;
+  }
+
+  // Namespace-scope variables and static data members, the locals are found
+  // through their DeclStmt
+  bool VisitVarDecl(clang::VarDecl *var) {
+    if (!var->hasGlobalStorage() || var->isStaticLocal())
+      return true;
+
+    if (!var->getDeclContext()->isFileContext() && !var->isStaticDataMember())
+      return true;
+
+    // The variables holding tuple-like structured bindings
+    if (var->isImplicit())
+      return true;
+
+    // Declarators sharing their specifiers share the fix-it as well
+    ++globalDeclarators_[var->getSourceRange().getBegin().getRawEncoding()];
+
+    if (var->isConstexpr() || var->hasAttr<clang::ConstInitAttr>() ||
+        !var->getInit())
+      return true;
+
+    // With -strongest, a mutable global can be constinit, but that only
+    // changes anything when it's initialized by a call
+    if (!var->getType().isConstQualified() &&
+        !(strongestEnabled() && containsCall(var->getInit())))
+      return true;
+
+    SourceLocation loc = var->getSourceRange().getBegin();
+    if (!isCandidateLocation(sourceManager_, loc))
+      return true;
+
+    // Templates are checked per instantiation, which can't be marked
+    if (var->isTemplated() ||
+        var->getTemplateSpecializationKind() != clang::TSK_Undeclared ||
+        isa<clang::VarTemplateSpecializationDecl>(var) ||
+        isa<clang::DecompositionDecl>(var))
+      return true;
+
+    // Every declaration would have to be constexpr, and a static data member
+    // can only be constexpr if it's initialized in the class
+    if (!var->isFirstDecl() || var->getStorageClass() == clang::SC_Extern)
+      return true;
+
+    stats_.count(Statistics::GlobalsVisited);
+
+    auto inserted = globalCandidates_.try_emplace(loc.getRawEncoding(),
+                                                  varCandidates_.size());
+    if (!inserted.second) {
+      varCandidates_[inserted.first->second].vars.push_back(var);
+      return true;
+    }
+
+    VarCandidate candidate;
+    candidate.vars.push_back(var);
+    candidate.loc = loc;
+    varCandidates_.push_back(candidate);
+
+    return true;
+  }
+
+  // Check the candidates collected by the traversal until nothing changes.
+  // Callees are checked before their callers, and a caller that was rejected
+  // is checked again whenever one of its callees becomes constexpr, so a
+  // single run finds everything repeated runs would. The variables are
+  // evaluated against the final function verdicts.
+  void solve() {
+    solveFunctions();
+    if (ClassesOption)
+      solveClasses();
+    for (const auto &candidate : varCandidates_)
+      solveVariable(candidate);
+    if (FoldCallsOption)
+      solveCalls();
+    // Calls and consteval checks past the limit are skipped without a trace
+    if (evaluationTimeSpent())
+      stats_.count(Statistics::EvaluationTimeSpent);
+    reportWarnings();
+
+    candidates_.clear();
+    varCandidates_.clear();
+    globalDeclarators_.clear();
+    globalCandidates_.clear();
+    candidatesByDecl_.clear();
+    calleesByDecl_.clear();
+    calls_.clear();
+    functionRefs_.clear();
+    calleeRefs_.clear();
+    unresolvedRefs_.clear();
+    records_.clear();
+    warnings_.clear();
+  }
+};
+
+/*
+ * TranslationUnitResult
+ *
+ * Everything a worker produces for a single TU. Workers only ever touch their
+ * own result; main() merges them in source list order once the pool has
+ * drained, so the output doesn't depend on scheduling.
+ */
+struct TranslationUnitResult {
+  std::string Directory;
+  std::string Diagnostics;
+  std::vector<clang::tooling::Replacement> Replacements;
+  std::vector<Finding> Findings;
+  // Only with -index-dir
+  std::vector<IndexedFunction> Index;
+  // Every file the TU read, only collected when caching
+  std::vector<std::string> Dependencies;
+  // Where to serialize the AST after parsing the TU from source, if anywhere
+  std::string ASTFile;
+  // Results computed from a serialized AST don't know every file the TU read
+  bool Cacheable = true;
+  Statistics Stats;
+  bool Failed = false;
+};
+
+namespace {
+// Paths are recorded with whatever name the FileEntry was opened with, which
+// may be relative to the compile command's directory.
+std::string makeAbsolutePath(const std::string &directory,
+                             llvm::StringRef path) {
+  llvm::SmallString<256> absolute(path);
+  if (!directory.empty())
+    llvm::sys::fs::make_absolute(directory, absolute);
+  llvm::sys::path::remove_dots(absolute, /*remove_dot_dot=*/true);
+  return absolute.str().str();
+}
+
+std::string hashContents(llvm::StringRef contents) {
+  llvm::MD5 hasher;
+  hasher.update(contents);
+  llvm::MD5::MD5Result hash;
+  hasher.final(hash);
+  return hash.digest().str().str();
+}
+
+// Write to a temporary and rename it into place so concurrent runs never see
+// a partial file
+bool writeFileAtomically(llvm::StringRef path, llvm::StringRef contents) {
+  int fd;
+  llvm::SmallString<256> tempPath;
+  if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%.tmp", fd, tempPath))
+    return false;
+
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << contents;
+  }
+
+  if (llvm::sys::fs::rename(tempPath, path)) {
+    llvm::sys::fs::remove(tempPath);
+    return false;
+  }
+  return true;
+}
+
+// Serialize the AST the same way `clang -emit-ast` does. This has to happen
+// before the analysis marks anything constexpr.
+bool writeASTFile(clang::Sema &sema, llvm::StringRef path) {
+  llvm::SmallVector<char, 128> buffer;
+  {
+    llvm::BitstreamWriter stream(buffer);
+    clang::InMemoryModuleCache moduleCache;
+    clang::ASTWriter writer(stream, buffer, moduleCache, {});
+    writer.WriteAST(sema, std::string(), nullptr, "");
+  }
+
+  return writeFileAtomically(path,
+                             llvm::StringRef(buffer.data(), buffer.size()));
+}
+} // namespace
+
+namespace {
+std::string mainFileName(const clang::SourceManager &sm) {
+  return compat::fileName(sm, sm.getMainFileID()).str();
+}
+
+// Runs the analysis on a parsed TU, whether it came from a frontend action or
+// a server's ASTUnit
+void analyzeTranslationUnit(clang::Sema &sema, Statistics &stats,
+                            std::vector<Finding> &findings,
+                            std::vector<IndexedFunction> *index) {
+  auto &astContext = sema.getASTContext();
+
+  // The evaluation limits only apply to our checks, not to parsing the TU.
+  // ASTContext only hands out its LangOptions as const, but they are the
+  // compiler instance's (or the loaded AST's) mutable options.
+  auto &langOpts = const_cast<clang::LangOptions &>(astContext.getLangOpts());
+  if (ConstexprStepsOption)
+    langOpts.ConstexprStepLimit = ConstexprStepsOption;
+  if (ConstexprDepthOption)
+    langOpts.ConstexprCallDepth = ConstexprDepthOption;
+  if (InterpOption != Interpreter::Classic)
+    compat::setBytecodeInterpreter(langOpts,
+                                   InterpOption == Interpreter::Bytecode);
+
+  ConstexprEverythingASTVisitor visitor(sema, stats, findings, index);
+  {
+    auto traversalStart = Statistics::now();
+    visitor.TraverseDecl(astContext.getTranslationUnitDecl());
+    stats.record(Statistics::Traversal, traversalStart,
+                 [&] { return mainFileName(sema.getSourceManager()); });
+  }
+  visitor.solve();
+
+  // Findings are recorded per phase, shared ones in the order TUs claim them
+  std::stable_sort(findings.begin(), findings.end(), findingBefore);
+}
+} // namespace
+
+class ConstexprEverythingASTConsumer : public clang::ASTConsumer {
+  clang::CompilerInstance &CI_;
+  std::string astFile_;
+  Statistics &stats_;
+  std::vector<Finding> &findings_;
+  std::vector<IndexedFunction> *index_;
+  // The consumer is created right before parsing starts
+  Statistics::Timestamp frontendStart_;
+
+public:
+  // override the constructor in order to pass CI
+  explicit ConstexprEverythingASTConsumer(clang::CompilerInstance &ci,
+                                          std::string astFile,
+                                          Statistics &stats,
+                                          std::vector<Finding> &findings,
+                                          std::vector<IndexedFunction> *index)
+      : CI_(ci), astFile_(std::move(astFile)), stats_(stats),
+        findings_(findings), index_(index),
+        frontendStart_(Statistics::now()) {}
+
+  void HandleTranslationUnit(clang::ASTContext &) override {
+    stats_.record(Statistics::Frontend, frontendStart_,
+                  [this] { return mainFileName(CI_.getSourceManager()); });
+
+    // ASTs with errors would be refused when loading them again
+    if (!astFile_.empty() && !CI_.getDiagnostics().hasErrorOccurred() &&
+        !writeASTFile(CI_.getSema(), astFile_))
+      llvm::errs() << "constexpr-everything: can't write " << astFile_ << "\n";
+
+    analyzeTranslationUnit(CI_.getSema(), stats_, findings_, index_);
+  }
+
+  // Only asked with -skip-function-bodies. Sema never skips constexpr bodies
+  // or ones with a deduced return type, so every header function a candidate
+  // could call in a constant expression still has its body.
+  bool shouldSkipFunctionBody(clang::Decl *decl) override {
+    return !isCandidateLocation(CI_.getSourceManager(),
+                                decl->getSourceRange().getBegin());
+  }
+};
+
+class FunctionDeclFrontendAction : public clang::ASTFrontendAction {
+  TranslationUnitResult &result_;
+
+public:
+  explicit FunctionDeclFrontendAction(TranslationUnitResult &result)
+      : result_(result) {}
+
+  bool BeginInvocation(clang::CompilerInstance &CI) override {
+    if (SkipFunctionBodiesOption)
+      CI.getFrontendOpts().SkipFunctionBodies = true;
+    return true;
+  }
+
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &CI,
+                    clang::StringRef file) override {
+    // Only serialize ASTs we just parsed, not the ones we loaded
+    std::string astFile = isCurrentFileAST() ? "" : result_.ASTFile;
+    auto *index = IndexDirOption.empty() ? nullptr : &result_.Index;
+    return std::make_unique<ConstexprEverythingASTConsumer>(
+        CI, std::move(astFile), result_.Stats, result_.Findings,
+        index); // pass CI pointer to ASTConsumer
+  }
+
+  void EndSourceFileAction() override {
+    if (isCurrentFileAST())
+      result_.Cacheable = false;
+
+    if (CacheDirOption.empty() || !result_.Cacheable)
+      return;
+
+    auto &sm = getCompilerInstance().getSourceManager();
+    compat::forEachLoadedFile(sm, [this](llvm::StringRef name) {
+      result_.Dependencies.push_back(makeAbsolutePath(result_.Directory, name));
+    });
+  }
+};
+
+class FunctionDeclFrontendActionFactory
+    : public clang::tooling::FrontendActionFactory {
+  TranslationUnitResult &result_;
+
+public:
+  explicit FunctionDeclFrontendActionFactory(TranslationUnitResult &result)
+      : result_(result) {}
+
+#if LLVM_VERSION_MAJOR >= 10
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<FunctionDeclFrontendAction>(result_);
+  }
+#else
+  clang::FrontendAction *create() override {
+    return new FunctionDeclFrontendAction(result_);
+  }
+#endif
+};
+
+/*
+ * CollectingDiagnosticConsumer
+ *
+ * Renders diagnostics into the TU's buffer instead of stderr and records the
+ * fix-its attached to them, so they can be applied once all workers are done
+ * rather than rewriting files from under the other workers.
+ */
+class CollectingDiagnosticConsumer : public clang::DiagnosticConsumer {
+  TranslationUnitResult &result_;
+  llvm::raw_string_ostream stream_;
+  clang::TextDiagnosticPrinter printer_;
+  clang::LangOptions langOpts_;
+
+public:
+  explicit CollectingDiagnosticConsumer(TranslationUnitResult &result)
+      : result_(result), stream_(result.Diagnostics),
+        printer_(stream_, new clang::DiagnosticOptions()) {}
+
+  ~CollectingDiagnosticConsumer() override { stream_.flush(); }
+
+  void BeginSourceFile(const clang::LangOptions &LO,
+                       const clang::Preprocessor *PP) override {
+    printer_.BeginSourceFile(LO, PP);
+    langOpts_ = LO;
+  }
+
+  void EndSourceFile() override { printer_.EndSourceFile(); }
+
+  void finish() override {
+    printer_.finish();
+    stream_.flush();
+  }
+
+  void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                        const clang::Diagnostic &info) override {
+    clang::DiagnosticConsumer::HandleDiagnostic(level, info);
+    printer_.HandleDiagnostic(level, info);
+
+    // Only warnings carry fixes we want, notes are alternatives and errors
+    // mean the TU didn't parse cleanly
+    if (level != clang::DiagnosticsEngine::Warning || !info.hasSourceManager())
+      return;
+
+    // Ranges in macros are written where the macro is used. The fix-its of a
+    // diagnostic only make sense together, so if any of them would have to
+    // go into a macro's definition, none are kept.
+    const auto &SM = info.getSourceManager();
+    std::vector<clang::tooling::Replacement> replacements;
+    for (const auto &hint : info.getFixItHints()) {
+      const auto range =
+          clang::Lexer::makeFileCharRange(hint.RemoveRange, SM, langOpts_);
+      if (range.isInvalid())
+        return;
+      replacements.emplace_back(SM, range, hint.CodeToInsert);
+    }
+    result_.Replacements.insert(result_.Replacements.end(),
+                                replacements.begin(), replacements.end());
+  }
+};
+
+namespace {
+/*
+ * Result cache
+ *
+ * With -cache-dir every TU's result is stored in a JSON file named after a
+ * hash of its compile commands, the tool version and the options that affect
+ * the analysis. The entry lists every file the TU read along with a hash of
+ * its contents; if none of them changed, the stored diagnostics and fix-its
+ * are replayed and the TU isn't parsed at all.
+ */
+constexpr unsigned CacheFormatVersion = 6;
+
+bool hashFile(llvm::StringRef path, std::string &hash) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return false;
+
+  hash = hashContents((*buffer)->getBuffer());
+  return true;
+}
+
+void hashCompileCommands(
+    llvm::raw_ostream &os,
+    const std::vector<clang::tooling::CompileCommand> &commands) {
+  os << clang::getClangFullVersion() << '\0';
+  for (const auto &command : commands) {
+    os << command.Directory << '\0' << command.Filename << '\0';
+    for (const auto &arg : command.CommandLine)
+      os << arg << '\0';
+  }
+}
+
+std::string
+cacheEntryPath(const std::vector<clang::tooling::CompileCommand> &commands) {
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  os << CacheFormatVersion << '\0' << (HeadersOption ? 1 : 0) << '\0'
+     << (TemplatesOption ? 1 : 0) << '\0' << (ProfileOption.empty() ? 0 : 1)
+     << '\0' << (FoldCallsOption ? 1 : 0) << '\0' << (StrongestOption ? 1 : 0)
+     << '\0' << static_cast<int>(InterpOption.getValue()) << '\0'
+     << (ClassesOption ? 1 : 0) << '\0'
+     // Diagnostics are only rendered for text output
+     << static_cast<int>(OutputFormatOption.getValue()) << '\0'
+     << ConstexprStepsOption.getValue() << '\0'
+     << ConstexprDepthOption.getValue() << '\0'
+     << EvalTimeLimitOption.getValue() << '\0'
+     << (SkipFunctionBodiesOption ? 1 : 0) << '\0';
+  hashCompileCommands(os, commands);
+
+  llvm::SmallString<256> path(CacheDirOption);
+  llvm::sys::path::append(path, hashContents(os.str()) + ".json");
+  return path.str().str();
+}
+
+/*
+ * Serialized ASTs
+ *
+ * With -ast-dir the AST of every TU parsed from source is written next to its
+ * result, named after a hash of its compile command. Later runs load it
+ * instead of parsing; the AST reader refuses ASTs whose inputs changed since
+ * they were written, in which case the TU is parsed again and the AST
+ * replaced.
+ */
+std::string
+astFilePath(const std::vector<clang::tooling::CompileCommand> &commands) {
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  hashCompileCommands(os, commands);
+
+  // Which bodies are in the AST depends on these
+  if (SkipFunctionBodiesOption)
+    os << '\0' << (HeadersOption ? 1 : 0);
+
+  llvm::SmallString<256> path(ASTDirOption);
+  llvm::sys::path::append(path, hashContents(os.str()) + ".ast");
+  return path.str().str();
+}
+
+// Run the analysis over a previously serialized AST. Returns false if it
+// couldn't be loaded, result is left untouched in that case.
+bool processASTFile(const std::string &astFile, TranslationUnitResult &result) {
+  if (!llvm::sys::fs::exists(astFile))
+    return false;
+
+  TranslationUnitResult loaded;
+  loaded.Directory = result.Directory;
+
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
+      llvm::vfs::createPhysicalFileSystem().release();
+  llvm::IntrusiveRefCntPtr<clang::FileManager> files(
+      new clang::FileManager(clang::FileSystemOptions(), fs));
+
+  {
+    CollectingDiagnosticConsumer consumer(loaded);
+    FunctionDeclFrontendActionFactory factory(loaded);
+
+    // The driver picks the AST input kind from the extension
+    ToolInvocation invocation(
+        {"constexpr-everything", "-fsyntax-only", astFile}, &factory,
+        files.get(), std::make_shared<PCHContainerOperations>());
+    invocation.setDiagnosticConsumer(&consumer);
+    if (!invocation.run() || consumer.getNumErrors() != 0)
+      return false;
+  }
+
+  result = std::move(loaded);
+  return true;
+}
+
+// The same object is used for cache entries, -output-format=jsonl and the
+// input of the merge subcommand
+llvm::json::Object findingToJSON(const Finding &finding,
+                                 const std::string &file) {
+  llvm::json::Object object{{"kind", Finding::name(finding.kind)},
+                            {"file", file},
+                            {"line", finding.Line},
+                            {"column", finding.Column},
+                            {"offset", finding.Offset},
+                            {"name", finding.Name},
+                            {"usr", finding.USR},
+                            {"fixit", finding.FixIt},
+                            {"dynamicInit", finding.RemovesDynamicInitializer}};
+  if (finding.Template)
+    object["template"] = true;
+  if (finding.Shared)
+    object["shared"] = true;
+  if (!finding.Symbol.empty())
+    object["symbol"] = finding.Symbol;
+  if (!ProfileOption.empty())
+    object["weight"] = static_cast<int64_t>(finding.Weight);
+  if (finding.kind == Finding::Instantiation) {
+    object["instantiation"] = finding.Instantiation;
+    object["constant"] = finding.Constant;
+  }
+  return object;
+}
+
+bool findingFromJSON(const llvm::json::Value &value, Finding &finding) {
+  const auto *object = value.getAsObject();
+  if (!object)
+    return false;
+
+  auto kind = object->getString("kind");
+  auto file = object->getString("file");
+  auto offset = object->getInteger("offset");
+  auto line = object->getInteger("line");
+  auto column = object->getInteger("column");
+  auto name = object->getString("name");
+  auto usr = object->getString("usr");
+  auto fixIt = object->getString("fixit");
+  if (!kind || !file || !offset || !line || !column || !name || !usr ||
+      !fixIt)
+    return false;
+
+  if (*kind == Finding::name(Finding::Function))
+    finding.kind = Finding::Function;
+  else if (*kind == Finding::name(Finding::Variable))
+    finding.kind = Finding::Variable;
+  else if (*kind == Finding::name(Finding::Instantiation))
+    finding.kind = Finding::Instantiation;
+  else
+    return false;
+
+  finding.File = file->str();
+  finding.Offset = *offset;
+  finding.Line = *line;
+  finding.Column = *column;
+  finding.Name = name->str();
+  finding.USR = usr->str();
+  finding.FixIt = fixIt->str();
+  // Not written before the global variable pass
+  auto dynamicInit = object->getBoolean("dynamicInit");
+  finding.RemovesDynamicInitializer = dynamicInit && *dynamicInit;
+  auto isTemplate = object->getBoolean("template");
+  finding.Template = isTemplate && *isTemplate;
+  auto shared = object->getBoolean("shared");
+  finding.Shared = shared && *shared;
+  if (auto symbol = object->getString("symbol"))
+    finding.Symbol = symbol->str();
+
+  if (finding.kind == Finding::Instantiation) {
+    auto instantiation = object->getString("instantiation");
+    auto constant = object->getBoolean("constant");
+    if (!instantiation || !constant)
+      return false;
+    finding.Instantiation = instantiation->str();
+    finding.Constant = *constant;
+  }
+  return true;
+}
+
+bool loadCachedResult(llvm::StringRef entryPath,
+                      TranslationUnitResult &result) {
+  auto buffer = llvm::MemoryBuffer::getFile(entryPath);
+  if (!buffer)
+    return false;
+
+  auto parsed = llvm::json::parse((*buffer)->getBuffer());
+  if (!parsed) {
+    llvm::consumeError(parsed.takeError());
+    return false;
+  }
+
+  const auto *entry = parsed->getAsObject();
+  if (!entry)
+    return false;
+
+  const auto *dependencies = entry->getArray("dependencies");
+  const auto *replacements = entry->getArray("replacements");
+  const auto *findings = entry->getArray("findings");
+  auto diagnostics = entry->getString("diagnostics");
+  if (!dependencies || !replacements || !findings || !diagnostics)
+    return false;
+
+  // Any change to any file the TU read invalidates the entry
+  for (const auto &value : *dependencies) {
+    const auto *dependency = value.getAsObject();
+    if (!dependency)
+      return false;
+
+    auto file = dependency->getString("file");
+    auto hash = dependency->getString("hash");
+    std::string current;
+    if (!file || !hash || !hashFile(*file, current) || current != *hash)
+      return false;
+  }
+
+  std::vector<clang::tooling::Replacement> cached;
+  for (const auto &value : *replacements) {
+    const auto *replacement = value.getAsObject();
+    if (!replacement)
+      return false;
+
+    auto file = replacement->getString("file");
+    auto offset = replacement->getInteger("offset");
+    auto length = replacement->getInteger("length");
+    auto text = replacement->getString("text");
+    if (!file || !offset || !length || !text)
+      return false;
+
+    cached.emplace_back(*file, *offset, *length, *text);
+  }
+
+  std::vector<Finding> cachedFindings;
+  for (const auto &value : *findings) {
+    Finding finding;
+    if (!findingFromJSON(value, finding))
+      return false;
+    cachedFindings.push_back(std::move(finding));
+  }
+
+  result.Diagnostics = diagnostics->str();
+  result.Replacements = std::move(cached);
+  result.Findings = std::move(cachedFindings);
+  return true;
+}
+
+void storeCachedResult(llvm::StringRef entryPath,
+                       const TranslationUnitResult &result) {
+  llvm::json::Array dependencies;
+  for (const auto &file : result.Dependencies) {
+    std::string hash;
+    if (!hashFile(file, hash))
+      return;
+    dependencies.push_back(llvm::json::Object{{"file", file}, {"hash", hash}});
+  }
+
+  llvm::json::Array replacements;
+  for (const auto &replacement : result.Replacements)
+    replacements.push_back(llvm::json::Object{
+        {"file", replacement.getFilePath().str()},
+        {"offset", replacement.getOffset()},
+        {"length", replacement.getLength()},
+        {"text", replacement.getReplacementText().str()}});
+
+  llvm::json::Array findings;
+  for (const auto &finding : result.Findings)
+    findings.push_back(findingToJSON(finding, finding.File));
+
+  llvm::json::Object entry{{"dependencies", std::move(dependencies)},
+                           {"diagnostics", result.Diagnostics},
+                           {"replacements", std::move(replacements)},
+                           {"findings", std::move(findings)}};
+
+  std::string contents;
+  llvm::raw_string_ostream os(contents);
+  os << llvm::json::Value(std::move(entry));
+  writeFileAtomically(entryPath, os.str());
+}
+
+/*
+ * Call-graph index
+ *
+ * With -index-dir every TU writes the IndexedFunctions of its candidates to a
+ * file named after a hash of its compile commands, for the unlock subcommand
+ * to combine. The format is compact and read straight from the mapped file:
+ * a magic number followed by little-endian 32-bit words, a string table of
+ * length-prefixed strings and then the functions, which refer to strings by
+ * their index:
+ *
+ *   "CXIDX002" count string[count] count function[count]
+ *   function: usr name file line flags record recordname count
+ *             (usr flags)[count]
+ */
+constexpr llvm::StringLiteral IndexMagic("CXIDX002");
+
+std::string
+indexFilePath(const std::vector<clang::tooling::CompileCommand> &commands) {
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  os << IndexMagic << '\0' << (HeadersOption ? 1 : 0) << '\0';
+  hashCompileCommands(os, commands);
+
+  llvm::SmallString<256> path(IndexDirOption);
+  llvm::sys::path::append(path, hashContents(os.str()) + ".cxidx");
+  return path.str().str();
+}
+
+bool writeIndexFile(llvm::StringRef path, const TranslationUnitResult &result) {
+  llvm::StringMap<uint32_t> ids;
+  std::vector<llvm::StringRef> strings;
+  auto intern = [&](llvm::StringRef string) -> uint32_t {
+    auto it = ids.try_emplace(string, strings.size());
+    if (it.second)
+      strings.push_back(it.first->getKey());
+    return it.first->second;
+  };
+
+  std::vector<uint32_t> words;
+  for (const auto &function : result.Index) {
+    words.push_back(intern(function.USR));
+    words.push_back(intern(function.Name));
+    words.push_back(intern(makeAbsolutePath(result.Directory, function.File)));
+    words.push_back(function.Line);
+    words.push_back(function.Flags);
+    words.push_back(intern(function.Record));
+    words.push_back(intern(function.RecordName));
+    words.push_back(function.Callees.size());
+    for (const auto &callee : function.Callees) {
+      words.push_back(intern(callee.USR));
+      words.push_back(callee.Flags);
+    }
+  }
+
+  std::string contents;
+  llvm::raw_string_ostream os(contents);
+  llvm::support::endian::Writer writer(os, llvm::support::little);
+  os << IndexMagic;
+  writer.write<uint32_t>(strings.size());
+  for (auto string : strings) {
+    writer.write<uint32_t>(string.size());
+    os << string;
+  }
+  writer.write<uint32_t>(result.Index.size());
+  for (auto word : words)
+    writer.write<uint32_t>(word);
+
+  return writeFileAtomically(path, os.str());
+}
+
+bool readIndexFile(llvm::StringRef contents,
+                   std::vector<IndexedFunction> &functions) {
+  if (!compat::startsWith(contents, IndexMagic))
+    return false;
+
+  const char *position = contents.data() + IndexMagic.size();
+  const char *end = contents.data() + contents.size();
+  bool valid = true;
+  auto word = [&]() -> uint32_t {
+    if (end - position < 4) {
+      valid = false;
+      return 0;
+    }
+    auto value = llvm::support::endian::read32le(position);
+    position += 4;
+    return value;
+  };
+
+  // Every string takes at least its length word
+  auto stringCount = word();
+  if (!valid || stringCount > static_cast<size_t>(end - position) / 4)
+    return false;
+
+  std::vector<llvm::StringRef> strings(stringCount);
+  for (auto &string : strings) {
+    auto size = word();
+    if (!valid || static_cast<size_t>(end - position) < size)
+      return false;
+    string = llvm::StringRef(position, size);
+    position += size;
+  }
+
+  auto string = [&]() -> std::string {
+    auto id = word();
+    if (id >= strings.size()) {
+      valid = false;
+      return std::string();
+    }
+    return strings[id].str();
+  };
+
+  for (auto count = word(); valid && count != 0; --count) {
+    IndexedFunction function;
+    function.USR = string();
+    function.Name = string();
+    function.File = string();
+    function.Line = word();
+    function.Flags = word();
+    function.Record = string();
+    function.RecordName = string();
+    for (auto callees = word(); valid && callees != 0; --callees) {
+      IndexedFunction::Callee callee;
+      callee.USR = string();
+      callee.Flags = word();
+      function.Callees.push_back(std::move(callee));
+    }
+    functions.push_back(std::move(function));
+  }
+  return valid;
+}
+
+void storeIndex(const std::vector<clang::tooling::CompileCommand> &commands,
+                const TranslationUnitResult &result) {
+  if (IndexDirOption.empty() || result.Failed)
+    return;
+
+  auto path = indexFilePath(commands);
+  if (!writeIndexFile(path, result))
+    llvm::errs() << "constexpr-everything: can't write " << path << "\n";
+}
+
+void processTranslationUnit(const CompilationDatabase &compilations,
+                            const std::string &path,
+                            TranslationUnitResult &result) {
+  auto commands = compilations.getCompileCommands(path);
+  if (!commands.empty())
+    result.Directory = commands.front().Directory;
+
+  // Cache entries don't hold the index, so indexing always analyzes the TU
+  std::string entryPath;
+  if (!CacheDirOption.empty() && IndexDirOption.empty()) {
+    entryPath = cacheEntryPath(commands);
+    if (loadCachedResult(entryPath, result))
+      return;
+  }
+
+  // A TU with several compile commands doesn't have a single AST
+  if (!ASTDirOption.empty() && commands.size() == 1) {
+    result.ASTFile = astFilePath(commands);
+    if (processASTFile(result.ASTFile, result)) {
+      storeIndex(commands, result);
+      return;
+    }
+  }
+
+  // Each worker gets its own VFS so that ClangTool can change the working
+  // directory without affecting the other workers.
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
+      llvm::vfs::createPhysicalFileSystem().release();
+  ClangTool Tool(compilations, {path},
+                 std::make_shared<PCHContainerOperations>(), fs);
+
+  {
+    CollectingDiagnosticConsumer consumer(result);
+    Tool.setDiagnosticConsumer(&consumer);
+
+    FunctionDeclFrontendActionFactory factory(result);
+    result.Failed = Tool.run(&factory) != 0;
+  }
+  storeIndex(commands, result);
+
+  // Failures are never cached so they get retried on the next run, and
+  // neither is a TU that ran out of budget, how far it got depends on timing.
+  // A TU that left header decls to another one lacks their findings, which a
+  // run without that TU would lose.
+  if (!entryPath.empty() && !result.Failed && result.Cacheable &&
+      !result.Stats.hitEvaluationBudget() &&
+      !result.Stats.deferredToAnotherTU())
+    storeCachedResult(entryPath, result);
+}
+
+// The contents of path with the fix-its applied, or none if it can't be
+// read. A fix-it that conflicts with another is reported, left out and clears
+// success.
+std::optional<std::string>
+rewriteFile(const std::string &path,
+            const std::set<clang::tooling::Replacement> &fixes,
+            bool &success) {
+  clang::tooling::Replacements replacements;
+  for (const auto &replacement : fixes) {
+    if (auto err = replacements.add(replacement)) {
+      llvm::errs() << "constexpr-everything: "
+                   << llvm::toString(std::move(err)) << "\n";
+      success = false;
+    }
+  }
+
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    llvm::errs() << "constexpr-everything: can't read " << path << ": "
+                 << buffer.getError().message() << "\n";
+    return std::nullopt;
+  }
+
+  auto code = clang::tooling::applyAllReplacements((*buffer)->getBuffer(),
+                                                   replacements);
+  if (!code) {
+    llvm::errs() << "constexpr-everything: "
+                 << llvm::toString(code.takeError()) << "\n";
+    return std::nullopt;
+  }
+  return std::move(*code);
+}
+
+bool applyReplacements(
+    const std::map<std::string, std::set<clang::tooling::Replacement>>
+        &fixes) {
+  bool success = true;
+
+  for (const auto &file : fixes) {
+    auto code = rewriteFile(file.first, file.second, success);
+    if (!code) {
+      success = false;
+      continue;
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(file.first, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      llvm::errs() << "constexpr-everything: can't write " << file.first
+                   << ": " << ec.message() << "\n";
+      success = false;
+      continue;
+    }
+    os << *code;
+  }
+
+  return success;
+}
+
+/*
+ * FindingWriter
+ *
+ * Streams findings for -output-format=jsonl and -output-format=sarif. Each TU
+ * is written as soon as it and every TU before it on the command line have
+ * finished, so output order doesn't depend on -j and a consumer can start
+ * reading before the whole run is done. SARIF needs an enclosing document,
+ * which is opened on construction and closed by finish().
+ */
+class FindingWriter {
+public:
+  explicit FindingWriter(llvm::raw_ostream &os) : os_(os) {
+    if (OutputFormatOption != OutputFormat::SARIF)
+      return;
+
+    llvm::json::Array rules;
+    for (auto kind : {Finding::Function, Finding::Variable})
+      rules.push_back(llvm::json::Object{
+          {"id", ruleId(kind)},
+          {"shortDescription",
+           llvm::json::Object{{"text", message(kind)}}}});
+
+    llvm::json::Object driver{{"name", "constexpr-everything"},
+                              {"rules", std::move(rules)}};
+
+    // Everything up to the results array, which is streamed by write()
+    sarif_.emplace(os_);
+    sarif_->objectBegin();
+    sarif_->attribute("$schema",
+                      "https://json.schemastore.org/sarif-2.1.0.json");
+    sarif_->attribute("version", "2.1.0");
+    sarif_->attributeBegin("runs");
+    sarif_->arrayBegin();
+    sarif_->objectBegin();
+    sarif_->attribute("tool",
+                      llvm::json::Object{{"driver", std::move(driver)}});
+    sarif_->attributeBegin("results");
+    sarif_->arrayBegin();
+  }
+
+  // Either the TU's own findings or the shared ones
+  void write(const TranslationUnitResult &result, bool shared = false) {
+    for (const auto &finding : result.Findings) {
+      if (finding.Shared != shared)
+        continue;
+      auto file = makeAbsolutePath(result.Directory, finding.File);
+      // Instantiations only matter to a later merge
+      if (OutputFormatOption == OutputFormat::JSONLines)
+        writeJSONLine(finding, file);
+      else if (finding.kind != Finding::Instantiation)
+        writeSARIFResult(finding, file);
+    }
+    os_.flush();
+  }
+
+  void finish() {
+    if (sarif_) {
+      sarif_->arrayEnd();
+      sarif_->attributeEnd();
+      sarif_->objectEnd();
+      sarif_->arrayEnd();
+      sarif_->attributeEnd();
+      sarif_->objectEnd();
+      os_ << "\n";
+    }
+    os_.flush();
+  }
+
+private:
+  llvm::raw_ostream &os_;
+  // Only with -output-format=sarif, the log is one JSON document
+  std::optional<llvm::json::OStream> sarif_;
+
+  static std::string ruleId(Finding::Kind kind) {
+    return std::string(Finding::name(kind)) + "-can-be-constexpr";
+  }
+
+  static std::string message(Finding::Kind kind) {
+    return std::string(Finding::name(kind)) + " can be constexpr";
+  }
+
+  // The specifier the fix-it inserts, consteval or constinit with -strongest
+  static std::string message(const Finding &finding) {
+    return std::string(Finding::name(finding.kind)) + " can be " +
+           llvm::StringRef(finding.FixIt).rtrim().str();
+  }
+
+  void writeJSONLine(const Finding &finding, const std::string &file) {
+    os_ << llvm::json::Value(findingToJSON(finding, file)) << "\n";
+  }
+
+  void writeSARIFResult(const Finding &finding, const std::string &file) {
+    // SARIF wants a URI, not a native path
+    std::string uri = "file://";
+    llvm::raw_string_ostream uriStream(uri);
+    for (char c : llvm::sys::path::convert_to_slash(file)) {
+      if (c == '%' || c == ' ' || c == '#' || c == '?')
+        uriStream << '%'
+                  << llvm::format_hex_no_prefix(static_cast<unsigned char>(c),
+                                                2, /*Upper=*/true);
+      else
+        uriStream << c;
+    }
+    uriStream.flush();
+
+    auto location = [&] { return llvm::json::Object{{"uri", uri}}; };
+
+    llvm::json::Object insertion{
+        {"deletedRegion", llvm::json::Object{{"charOffset", finding.Offset},
+                                             {"charLength", 0}}},
+        {"insertedContent", llvm::json::Object{{"text", finding.FixIt}}}};
+
+    llvm::json::Object change{
+        {"artifactLocation", location()},
+        {"replacements", llvm::json::Array{std::move(insertion)}}};
+
+    llvm::json::Object physicalLocation{
+        {"artifactLocation", location()},
+        {"region", llvm::json::Object{{"startLine", finding.Line},
+                                      {"startColumn", finding.Column},
+                                      {"charOffset", finding.Offset}}}};
+
+    llvm::json::Object sarif{
+        {"ruleId", ruleId(finding.kind)},
+        {"level", "warning"},
+        {"message", llvm::json::Object{{"text", message(finding)}}},
+        {"locations",
+         llvm::json::Array{llvm::json::Object{
+             {"physicalLocation", std::move(physicalLocation)},
+             {"logicalLocations",
+              llvm::json::Array{llvm::json::Object{
+                  {"fullyQualifiedName", finding.Name}}}}}}},
+        {"fixes", llvm::json::Array{llvm::json::Object{
+                      {"artifactChanges",
+                       llvm::json::Array{std::move(change)}}}}},
+        {"properties",
+         llvm::json::Object{{"usr", finding.USR},
+                            {"removesDynamicInitializer",
+                             finding.RemovesDynamicInitializer}}}};
+
+    sarif_->value(std::move(sarif));
+  }
+};
+
+// Writes the fixes of the whole run as a single replacements document, the
+// format clang-tidy -export-fixes uses for clang-apply-replacements
+bool exportFixes(
+    llvm::StringRef path,
+    const std::map<std::string, std::set<clang::tooling::Replacement>> &fixes) {
+  clang::tooling::TranslationUnitReplacements document;
+  for (const auto &file : fixes)
+    document.Replacements.insert(document.Replacements.end(),
+                                 file.second.begin(), file.second.end());
+
+  std::string contents;
+  llvm::raw_string_ostream os(contents);
+  llvm::yaml::Output yaml(os);
+  yaml << document;
+  return writeFileAtomically(path, os.str());
+}
+
+bool writeTimeTrace(llvm::StringRef path,
+                    const std::vector<TranslationUnitResult> &results,
+                    const Statistics &global) {
+  llvm::json::Array events;
+  auto addEvents = [&events](const Statistics &stats) {
+    for (const auto &event : stats.Trace)
+      events.push_back(llvm::json::Object{
+          {"pid", 1},
+          {"tid", static_cast<int64_t>(event.Thread)},
+          {"ph", "X"},
+          {"ts", static_cast<int64_t>(event.Start)},
+          {"dur", static_cast<int64_t>(event.Duration)},
+          {"name", event.Name},
+          {"args", llvm::json::Object{{"detail", event.Detail}}}});
+  };
+
+  for (const auto &result : results)
+    addEvents(result.Stats);
+  addEvents(global);
+
+  std::string contents;
+  llvm::raw_string_ostream os(contents);
+  os << llvm::json::Value(
+      llvm::json::Object{{"traceEvents", std::move(events)}});
+  return writeFileAtomically(path, os.str());
+}
+
+// Peak resident set size of the process in bytes, 0 where it isn't known
+uint64_t peakMemory() {
+#if defined(__unix__) || defined(__APPLE__)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+  return 0;
+}
+
+// Resident set size of the process in bytes
+uint64_t currentMemory() {
+#ifdef __linux__
+  // Sizes in pages: total program size, then resident
+  std::ifstream statm("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  if (statm >> size >> resident)
+    return resident * uint64_t(sysconf(_SC_PAGESIZE));
+#endif
+  return llvm::sys::Process::GetMallocUsage();
+}
+
+/*
+ * MemoryScheduler
+ *
+ * With -max-memory, admits a TU to a worker only while the process's resident
+ * memory plus what the running TUs are still expected to need stays within
+ * the budget. What a TU needs is learned from the ones that finished: the
+ * largest growth of the resident memory over the run of a single TU. Until
+ * the first one finishes only one TU runs at a time, and a TU is always
+ * admitted when nothing else runs, so a budget that's too small only makes
+ * the run serial.
+ */
+class MemoryScheduler {
+public:
+  struct Ticket {
+    uint64_t Reserved = 0;
+    uint64_t StartMemory = 0;
+  };
+
+  explicit MemoryScheduler(uint64_t budget) : budget_(budget) {}
+
+  Ticket admit() {
+    Ticket ticket;
+    if (budget_ == 0)
+      return ticket;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    admitted_.wait(lock, [this] {
+      if (running_ == 0)
+        return true;
+      return learned_ && currentMemory() + reserved_ + estimate_ <= budget_;
+    });
+    ++running_;
+    ticket.Reserved = estimate_;
+    ticket.StartMemory = currentMemory();
+    reserved_ += ticket.Reserved;
+    return ticket;
+  }
+
+  void release(const Ticket &ticket) {
+    if (budget_ == 0)
+      return;
+
+    // The growth includes what the other running TUs allocated meanwhile,
+    // which errs on the side of running fewer TUs
+    uint64_t memory = currentMemory();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --running_;
+      reserved_ -= ticket.Reserved;
+      if (memory > ticket.StartMemory)
+        estimate_ = std::max(estimate_, memory - ticket.StartMemory);
+      learned_ = true;
+    }
+
+    // The TU's AST is gone by now, but glibc keeps freed memory in its
+    // arenas where it still counts as resident
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    admitted_.notify_all();
+  }
+
+private:
+  uint64_t budget_;
+  std::mutex mutex_;
+  std::condition_variable admitted_;
+  unsigned running_ = 0;
+  // What the running TUs were expected to need when they were admitted
+  uint64_t reserved_ = 0;
+  uint64_t estimate_ = 0;
+  bool learned_ = false;
+};
+
+// Nearest-rank percentile of sorted latencies, in microseconds
+double latencyPercentile(const std::vector<double> &sorted, double percent) {
+  if (sorted.empty())
+    return 0;
+
+  size_t rank = size_t(std::ceil(percent / 100 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1] * 1e6;
+}
+
+// The -stats-json summary of a run, for tracking the tool's own performance
+bool writeStatsJSON(llvm::StringRef path,
+                    const std::vector<TranslationUnitResult> &results,
+                    const Statistics &total, double wall) {
+  llvm::json::Object phases;
+  for (unsigned i = 0; i < Statistics::NumPhases; ++i)
+    phases[Statistics::name(static_cast<Statistics::Phase>(i))] =
+        llvm::json::Object{{"wall", total.Phases[i].Wall},
+                           {"cpu", total.Phases[i].CPU}};
+
+  llvm::json::Object counters;
+  for (unsigned i = 0; i < Statistics::NumCounters; ++i)
+    counters[Statistics::name(static_cast<Statistics::Counter>(i))] =
+        static_cast<int64_t>(total.Counters[i]);
+
+  auto latencies = total.Latencies;
+  std::sort(latencies.begin(), latencies.end());
+  auto failed = llvm::count_if(
+      results, [](const TranslationUnitResult &unit) { return unit.Failed; });
+
+  llvm::json::Object summary{
+      {"translationUnits", static_cast<int64_t>(results.size())},
+      {"failedTranslationUnits", static_cast<int64_t>(failed)},
+      {"wall", wall},
+      {"translationUnitsPerSecond", wall > 0 ? results.size() / wall : 0.0},
+      {"peakRSS", static_cast<int64_t>(peakMemory())},
+      {"evaluationLatencyMicroseconds",
+       llvm::json::Object{{"count", static_cast<int64_t>(latencies.size())},
+                          {"p50", latencyPercentile(latencies, 50)},
+                          {"p90", latencyPercentile(latencies, 90)},
+                          {"p99", latencyPercentile(latencies, 99)},
+                          {"max", latencyPercentile(latencies, 100)}}},
+      {"phases", std::move(phases)},
+      {"counters", std::move(counters)}};
+
+  std::string contents;
+  llvm::raw_string_ostream os(contents);
+  os << llvm::json::Value(std::move(summary)) << "\n";
+  return writeFileAtomically(path, os.str());
+}
+
+/*
+ * Sharding
+ *
+ * -shard=K/N splits the source list into N parts of about the same cost so a
+ * sweep can be spread over several hosts. Every host computes the same split
+ * from the same checkout: TUs are handed out greedily, most expensive first,
+ * each to the currently cheapest shard, with ties broken by source list
+ * position. A TU's cost is estimated from the size of its main file plus a
+ * flat amount for the headers every TU parses.
+ */
+constexpr uint64_t TranslationUnitOverhead = 64 * 1024;
+
+bool parseShard(llvm::StringRef spec, unsigned &index, unsigned &count) {
+  llvm::StringRef indexText, countText;
+  std::tie(indexText, countText) = spec.split('/');
+  if (indexText.getAsInteger(10, index) || countText.getAsInteger(10, count))
+    return false;
+  return count > 0 && index >= 1 && index <= count;
+}
+
+std::vector<std::string> selectShard(const std::vector<std::string> &sources,
+                                     unsigned index, unsigned count) {
+  std::vector<uint64_t> costs;
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    uint64_t size = 0;
+    if (llvm::sys::fs::file_size(sources[i], size))
+      size = 0;
+    costs.push_back(TranslationUnitOverhead + size);
+    order.push_back(i);
+  }
+
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+  std::vector<uint64_t> loads(count, 0);
+  std::vector<bool> selected(sources.size(), false);
+  for (auto i : order) {
+    auto cheapest = std::min_element(loads.begin(), loads.end());
+    *cheapest += costs[i];
+    selected[i] = static_cast<unsigned>(cheapest - loads.begin()) == index - 1;
+  }
+
+  // Keep the source list order within a shard
+  std::vector<std::string> shard;
+  for (size_t i = 0; i < sources.size(); ++i)
+    if (selected[i])
+      shard.push_back(sources[i]);
+  return shard;
+}
+
+using FixMap = std::map<std::string, std::set<clang::tooling::Replacement>>;
+
+void addFinding(const std::string &directory, const Finding &finding,
+                FixMap &fixes) {
+  if (finding.kind == Finding::Instantiation)
+    return;
+
+  auto path = makeAbsolutePath(directory, finding.File);
+  fixes[path].emplace(path, finding.Offset, 0, finding.FixIt);
+}
+
+// Prints a finding without the SourceManager of its TU
+void printFinding(const Finding &finding) {
+  llvm::errs() << finding.File << ":" << finding.Line << ":" << finding.Column
+               << ": warning: " << Finding::name(finding.kind)
+               << (finding.Template ? " template" : "") << " can be "
+               << llvm::StringRef(finding.FixIt).rtrim()
+               << (finding.RemovesDynamicInitializer
+                       ? ", removing its dynamic initializer"
+                       : "")
+               << "\n";
+}
+
+/*
+ * Templates
+ *
+ * With -templates every TU reports how each instantiation it checked fared,
+ * at the location of the instantiation's pattern. A pattern is marked once
+ * every instantiation seen in the run can be constexpr. When only some of them
+ * can, it's reported as conditionally constexpr and left alone. An
+ * instantiation that TUs disagree about counts as not constant.
+ */
+std::vector<Finding>
+decideTemplates(const std::vector<Finding> &instantiations) {
+  struct Template {
+    const Finding *Pattern = nullptr;
+    std::map<std::string, uint64_t> Constant;
+    std::set<std::string> NotConstant;
+  };
+
+  std::map<std::pair<std::string, unsigned>, Template> templates;
+  for (const auto &instantiation : instantiations) {
+    auto &entry = templates[{instantiation.File, instantiation.Offset}];
+    if (!entry.Pattern)
+      entry.Pattern = &instantiation;
+    if (instantiation.Constant)
+      entry.Constant.emplace(instantiation.Instantiation, instantiation.Weight);
+    else
+      entry.NotConstant.insert(instantiation.Instantiation);
+  }
+
+  std::vector<Finding> decided;
+  for (auto &it : templates) {
+    auto &entry = it.second;
+    for (const auto &name : entry.NotConstant)
+      entry.Constant.erase(name);
+    if (entry.Constant.empty())
+      continue;
+
+    const auto &pattern = *entry.Pattern;
+    if (!entry.NotConstant.empty()) {
+      std::vector<llvm::StringRef> constant;
+      for (const auto &instantiation : entry.Constant)
+        constant.push_back(instantiation.first);
+      llvm::errs() << pattern.File << ":" << pattern.Line << ":"
+                   << pattern.Column << ": remark: " << pattern.Name
+                   << " is conditionally constexpr, it can be for "
+                   << llvm::join(constant.begin(), constant.end(), ", ")
+                   << " but not for "
+                   << llvm::join(entry.NotConstant.begin(),
+                                 entry.NotConstant.end(), ", ")
+                   << "\n";
+      continue;
+    }
+
+    Finding finding = pattern;
+    finding.kind = Finding::Function;
+    finding.Template = true;
+    finding.Instantiation.clear();
+    finding.Constant = false;
+    finding.Symbol.clear();
+    finding.Weight = 0;
+    for (const auto &instantiation : entry.Constant)
+      finding.Weight += instantiation.second;
+    decided.push_back(std::move(finding));
+  }
+  return decided;
+}
+
+/*
+ * Profiles
+ *
+ * -profile weighs every finding by how often the function it saves work in
+ * ran: the function itself, the one a local variable is declared in, or each
+ * instantiation of a template. Globals are initialized once and weigh
+ * nothing. Indexed profiles from llvm-profdata give the entry count of each
+ * function, other profilers can be converted to '<mangled name> <count>'
+ * lines, e.g. from perf report --no-demangle.
+ */
+using ProfileWeights = llvm::StringMap<uint64_t>;
+
+// Names of functions with internal linkage are prefixed with their file
+llvm::StringRef profileSymbol(llvm::StringRef name) {
+  auto separator = name.find_last_of(":;");
+  return separator == llvm::StringRef::npos ? name
+                                            : name.drop_front(separator + 1);
+}
+
+bool loadProfile(llvm::StringRef path, ProfileWeights &weights) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+    return false;
+
+  if (llvm::IndexedInstrProfReader::hasFormat(**buffer)) {
+    auto reader = compat::createProfileReader(path);
+    if (!reader) {
+      llvm::consumeError(reader.takeError());
+      return false;
+    }
+
+    // Without the entry counter, telling which counter belongs to the entry
+    // block takes the function's CFG. The hottest counter stands in for it,
+    // which favours functions with loops.
+    const bool entryCounts = compat::hasEntryCounts(**reader);
+    if (!entryCounts)
+      llvm::errs() << "constexpr-everything: " << path
+                   << " has no entry counts, functions are weighed by their "
+                      "hottest counter instead\n";
+    for (const auto &record : **reader) {
+      if (record.Counts.empty())
+        continue;
+      weights[profileSymbol(record.Name)] +=
+          entryCounts ? record.Counts.front()
+                      : *std::max_element(record.Counts.begin(),
+                                          record.Counts.end());
+    }
+    if ((*reader)->hasError()) {
+      llvm::consumeError((*reader)->getError());
+      return false;
+    }
+    return true;
+  }
+
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  (*buffer)->getBuffer().split(lines, '\n', /*MaxSplit=*/-1,
+                               /*KeepEmpty=*/false);
+  for (auto line : lines) {
+    line = line.trim();
+    if (line.empty() || compat::startsWith(line, "#"))
+      continue;
+
+    llvm::StringRef symbol, countText;
+    std::tie(symbol, countText) = line.split(' ');
+    uint64_t count;
+    if (countText.trim().getAsInteger(10, count))
+      return false;
+    weights[profileSymbol(symbol)] += count;
+  }
+  return true;
+}
+
+void annotateWeights(std::vector<Finding> &findings,
+                     const ProfileWeights &weights) {
+  for (auto &finding : findings) {
+    if (finding.Symbol.empty())
+      continue;
+    auto it = weights.find(finding.Symbol);
+    if (it != weights.end())
+      finding.Weight = it->second;
+  }
+}
+
+// Heaviest first, ties keep their order
+void rankFindings(std::vector<Finding> &findings) {
+  std::stable_sort(findings.begin(), findings.end(),
+                   [](const Finding &a, const Finding &b) {
+                     if (a.Weight != b.Weight)
+                       return a.Weight > b.Weight;
+                     return findingBefore(a, b);
+                   });
+}
+
+void printRanking(const std::vector<Finding> &findings) {
+  auto &os = llvm::outs();
+  os << llvm::format("%14s  %s\n", "weight", "finding");
+  for (const auto &finding : findings) {
+    if (finding.kind == Finding::Instantiation)
+      continue;
+    os << llvm::format("%14llu  ",
+                       static_cast<unsigned long long>(finding.Weight))
+       << finding.File << ":" << finding.Line << ":" << finding.Column << ": "
+       << Finding::name(finding.kind) << (finding.Template ? " template " : " ")
+       << finding.Name << "\n";
+  }
+  os.flush();
+}
+
+// Where the builtin headers are, next to the binary like ClangTool expects
+std::string resourceDirectory(const char *argv0) {
+  static int StaticSymbol;
+  return clang::CompilerInvocation::GetResourcesPath(
+      argv0, reinterpret_cast<void *>(&StaticSymbol));
+}
+
+/*
+ * Impact
+ *
+ * -impact compiles a sample of the TUs with findings to an object file in
+ * memory twice: as they are, and on top of a VFS holding every file the
+ * fix-its touch with them applied. Code is generated while the TU is parsed,
+ * so the frontend time includes IR generation and the backend time is what
+ * follows the end of the TU. The emitted functions are the definitions left
+ * in the module once the backend is done with it. Each version is compiled
+ * once, so small time differences are noise.
+ */
+struct CompileCost {
+  double Frontend = 0;
+  double Backend = 0;
+  uint64_t ObjectSize = 0;
+  uint64_t Functions = 0;
+
+  void add(const CompileCost &other) {
+    Frontend += other.Frontend;
+    Backend += other.Backend;
+    ObjectSize += other.ObjectSize;
+    Functions += other.Functions;
+  }
+};
+
+// Notes when the parser is done with the TU, which the consumers after it
+// only hear about afterwards
+class EndOfParseConsumer : public clang::ASTConsumer {
+  std::chrono::steady_clock::time_point &end_;
+
+public:
+  explicit EndOfParseConsumer(std::chrono::steady_clock::time_point &end)
+      : end_(end) {}
+
+  void HandleTranslationUnit(clang::ASTContext &) override {
+    end_ = std::chrono::steady_clock::now();
+  }
+};
+
+class MeasuredEmitObjAction : public clang::EmitObjAction {
+public:
+  std::chrono::steady_clock::time_point ParseEnd;
+
+protected:
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &ci,
+                    llvm::StringRef file) override {
+    auto backend = EmitObjAction::CreateASTConsumer(ci, file);
+    if (!backend)
+      return nullptr;
+
+    std::vector<std::unique_ptr<clang::ASTConsumer>> consumers;
+    consumers.push_back(std::make_unique<EndOfParseConsumer>(ParseEnd));
+    consumers.push_back(std::move(backend));
+    return std::make_unique<clang::MultiplexConsumer>(std::move(consumers));
+  }
+};
+
+// Compiles the TU of command on fs, false if it doesn't compile
+bool compileInMemory(const CompileCommand &command,
+                     const std::string &resourceDir,
+                     llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
+                     CompileCost &cost) {
+  auto adjuster = combineAdjusters(
+      combineAdjusters(getClangStripOutputAdjuster(),
+                       getClangStripDependencyFileAdjuster()),
+      getInsertArgumentAdjuster(("-resource-dir=" + resourceDir).c_str(),
+                                ArgumentInsertPosition::BEGIN));
+  auto args = adjuster(command.CommandLine, command.Filename);
+  std::vector<const char *> argv;
+  for (const auto &arg : args)
+    argv.push_back(arg.c_str());
+
+  fs->setCurrentWorkingDirectory(command.Directory);
+  auto diagnostics = clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions(), new clang::IgnoringDiagConsumer());
+  std::shared_ptr<clang::CompilerInvocation> invocation =
+      compat::createInvocation(argv, diagnostics, fs);
+  if (!invocation)
+    return false;
+  // Not even the "N warnings generated" summary
+  invocation->getDiagnosticOpts().ShowCarets = false;
+
+  clang::CompilerInstance compiler;
+  compiler.setInvocation(std::move(invocation));
+  compiler.createDiagnostics(new clang::IgnoringDiagConsumer());
+  compiler.createFileManager(fs);
+
+  llvm::SmallVector<char, 0> object;
+  compiler.setOutputStream(std::make_unique<llvm::raw_svector_ostream>(object));
+
+  MeasuredEmitObjAction action;
+  const auto start = std::chrono::steady_clock::now();
+  const bool compiled = compiler.ExecuteAction(action);
+  const auto end = std::chrono::steady_clock::now();
+  if (!compiled || compiler.getDiagnostics().hasErrorOccurred())
+    return false;
+
+  cost.Frontend =
+      std::chrono::duration<double>(action.ParseEnd - start).count();
+  cost.Backend = std::chrono::duration<double>(end - action.ParseEnd).count();
+  cost.ObjectSize = object.size();
+  if (auto module = action.takeModule())
+    for (const auto &function : *module)
+      if (!function.isDeclaration())
+        ++cost.Functions;
+  return true;
+}
+
+// The change from before to after in percent
+double percentChange(double before, double after) {
+  return before == 0 ? 0 : (after - before) / before * 100;
+}
+
+bool estimateImpact(const CompilationDatabase &compilations,
+                    const std::vector<std::string> &sources,
+                    const std::vector<TranslationUnitResult> &results,
+                    const FixMap &fixes, const char *argv0) {
+  // Compiled for the host, whatever the TUs target
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  // Evenly spread over the TUs with findings of their own, in source order
+  std::vector<size_t> affected;
+  for (size_t i = 0; i < results.size(); ++i)
+    if (llvm::any_of(results[i].Findings, [](const Finding &finding) {
+          return finding.kind != Finding::Instantiation;
+        }))
+      affected.push_back(i);
+  const size_t count = std::min<size_t>(ImpactOption, affected.size());
+
+  bool success = true;
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> rewritten(
+      new llvm::vfs::InMemoryFileSystem());
+  for (const auto &file : fixes) {
+    auto code = rewriteFile(file.first, file.second, success);
+    if (!code)
+      return false;
+    rewritten->addFile(file.first, /*ModificationTime=*/0,
+                       llvm::MemoryBuffer::getMemBufferCopy(*code, file.first));
+  }
+
+  struct DirectoryImpact {
+    unsigned TUs = 0;
+    CompileCost Before;
+    CompileCost After;
+  };
+  std::map<std::string, DirectoryImpact> directories;
+  DirectoryImpact total;
+  const auto resourceDir = resourceDirectory(argv0);
+  for (size_t i = 0; i < count; ++i) {
+    const auto &source = sources[affected[i * affected.size() / count]];
+    auto commands = compilations.getCompileCommands(source);
+    if (commands.empty())
+      continue;
+    const auto &command = commands.front();
+
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> original =
+        llvm::vfs::createPhysicalFileSystem().release();
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> fixed(
+        new llvm::vfs::OverlayFileSystem(
+            llvm::vfs::createPhysicalFileSystem().release()));
+    fixed->pushOverlay(rewritten);
+
+    CompileCost before, after;
+    if (!compileInMemory(command, resourceDir, original, before) ||
+        !compileInMemory(command, resourceDir, fixed, after)) {
+      llvm::errs() << "constexpr-everything: can't compile " << source
+                   << " to measure its impact\n";
+      success = false;
+      continue;
+    }
+
+    auto file = makeAbsolutePath(command.Directory, command.Filename);
+    for (auto *impact :
+         {&directories[llvm::sys::path::parent_path(file).str()], &total}) {
+      ++impact->TUs;
+      impact->Before.add(before);
+      impact->After.add(after);
+    }
+  }
+
+  auto &os = llvm::errs();
+  os << "===" << std::string(73, '-') << "===\n"
+     << "  constexpr-everything impact: " << total.TUs << " of "
+     << affected.size() << " TUs with findings\n"
+     << "===" << std::string(73, '-') << "===\n";
+  os << llvm::format("  %5s %11s %11s %11s %9s %9s  %s\n", "TUs",
+                     "frontend %", "backend %", "object B", "object %",
+                     "functions", "directory");
+  auto print = [&os](const DirectoryImpact &impact, llvm::StringRef name) {
+    const auto &before = impact.Before;
+    const auto &after = impact.After;
+    os << llvm::format(
+        "  %5u %+11.1f %+11.1f %+11lld %+9.1f %+9lld  %s\n", impact.TUs,
+        percentChange(before.Frontend, after.Frontend),
+        percentChange(before.Backend, after.Backend),
+        static_cast<long long>(after.ObjectSize) -
+            static_cast<long long>(before.ObjectSize),
+        percentChange(before.ObjectSize, after.ObjectSize),
+        static_cast<long long>(after.Functions) -
+            static_cast<long long>(before.Functions),
+        name.str().c_str());
+  };
+  for (const auto &directory : directories)
+    print(directory.second, directory.first);
+  if (total.TUs != 0)
+    print(total, "total");
+  return success;
+}
+
+bool writeFixes(const FixMap &fixes, Statistics &total) {
+  bool success = true;
+  if (!ExportFixesOption.empty() && !exportFixes(ExportFixesOption, fixes)) {
+    llvm::errs() << "constexpr-everything: can't write " << ExportFixesOption
+                 << "\n";
+    success = false;
+  }
+
+  if (ConstExprFixItOption) {
+    auto start = Statistics::now();
+    if (!applyReplacements(fixes))
+      success = false;
+    total.record(Statistics::ApplyFixes, start,
+                 [] { return std::string("apply fixes"); });
+  }
+  return success;
+}
+
+// Sets output to where findings go, or to null if the file can't be opened
+std::unique_ptr<llvm::raw_fd_ostream> openOutput(llvm::raw_ostream *&output) {
+  output = &llvm::outs();
+  if (OutputFormatOption == OutputFormat::Text || OutputOption == "-")
+    return nullptr;
+
+  std::error_code ec;
+  auto file = std::make_unique<llvm::raw_fd_ostream>(OutputOption, ec,
+                                                     llvm::sys::fs::OF_Text);
+  if (ec) {
+    llvm::errs() << "constexpr-everything: can't write " << OutputOption
+                 << ": " << ec.message() << "\n";
+    output = nullptr;
+    return nullptr;
+  }
+  output = file.get();
+  return file;
+}
+
+/*
+ * merge subcommand
+ *
+ * Combines the per-shard outputs of -output-format=jsonl and -export-fixes
+ * into one result. Findings are deduplicated by location and sorted by file
+ * and offset, fix-its are deduplicated like those of a single run, after
+ * which the usual -output-format, -export-fixes and -fix handling applies.
+ */
+bool loadFindings(llvm::StringRef contents, std::vector<Finding> &findings) {
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  contents.split(lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (auto line : lines) {
+    if (line.trim().empty())
+      continue;
+
+    auto parsed = llvm::json::parse(line);
+    if (!parsed) {
+      llvm::consumeError(parsed.takeError());
+      return false;
+    }
+
+    Finding finding;
+    if (!findingFromJSON(*parsed, finding))
+      return false;
+    findings.push_back(std::move(finding));
+  }
+  return true;
+}
+
+bool loadFixes(llvm::StringRef contents, FixMap &fixes) {
+  clang::tooling::TranslationUnitReplacements document;
+  llvm::yaml::Input yaml(contents);
+  yaml >> document;
+  if (yaml.error())
+    return false;
+
+  for (const auto &replacement : document.Replacements) {
+    auto path = makeAbsolutePath("", replacement.getFilePath());
+    fixes[path].emplace(path, replacement.getOffset(), replacement.getLength(),
+                        replacement.getReplacementText());
+  }
+  return true;
+}
+
+int merge() {
+  bool failed = false;
+  std::vector<Finding> findings;
+  FixMap fixes;
+  for (const auto &input : MergeInputsOption) {
+    auto buffer = llvm::MemoryBuffer::getFileOrSTDIN(input);
+    if (!buffer) {
+      llvm::errs() << "constexpr-everything: can't read " << input << ": "
+                   << buffer.getError().message() << "\n";
+      failed = true;
+      continue;
+    }
+
+    // Both formats are recognised by their first character
+    auto contents = (*buffer)->getBuffer();
+    bool loaded = compat::startsWith(contents.ltrim(), "{")
+                      ? loadFindings(contents, findings)
+                      : loadFixes(contents, fixes);
+    if (!loaded) {
+      llvm::errs() << "constexpr-everything: " << input
+                   << " is neither jsonl findings nor exported fixes\n";
+      failed = true;
+    }
+  }
+
+  ProfileWeights weights;
+  if (!ProfileOption.empty()) {
+    if (!loadProfile(ProfileOption, weights)) {
+      llvm::errs() << "constexpr-everything: can't read profile "
+                   << ProfileOption << "\n";
+      return 1;
+    }
+    annotateWeights(findings, weights);
+  }
+
+  // Templates decided by the inputs only saw part of the instantiations
+  findings.erase(std::remove_if(findings.begin(), findings.end(),
+                                [](const Finding &finding) {
+                                  return finding.Template;
+                                }),
+                 findings.end());
+
+  // Instantiations the inputs disagree about keep both verdicts, so that
+  // decideTemplates sees the disagreement
+  auto key = [](const Finding &finding) {
+    return std::make_tuple(llvm::StringRef(finding.File), finding.Offset,
+                           finding.kind, llvm::StringRef(finding.Instantiation),
+                           finding.Constant);
+  };
+  std::sort(findings.begin(), findings.end(),
+            [&](const Finding &a, const Finding &b) {
+              return key(a) < key(b);
+            });
+  findings.erase(std::unique(findings.begin(), findings.end(),
+                             [&](const Finding &a, const Finding &b) {
+                               return key(a) == key(b);
+                             }),
+                 findings.end());
+
+  std::vector<Finding> instantiations;
+  std::copy_if(findings.begin(), findings.end(),
+               std::back_inserter(instantiations), [](const Finding &finding) {
+                 return finding.kind == Finding::Instantiation;
+               });
+  for (auto &finding : decideTemplates(instantiations))
+    findings.push_back(std::move(finding));
+
+  // Already in one order across all inputs
+  for (auto &finding : findings)
+    finding.Shared = false;
+
+  TranslationUnitResult merged;
+  merged.Findings = std::move(findings);
+  for (const auto &finding : merged.Findings)
+    addFinding("", finding, fixes);
+  if (!ProfileOption.empty())
+    rankFindings(merged.Findings);
+
+  if (OutputFormatOption == OutputFormat::Text) {
+    if (!ProfileOption.empty())
+      printRanking(merged.Findings);
+    else
+      for (const auto &finding : merged.Findings)
+        if (finding.kind != Finding::Instantiation)
+          printFinding(finding);
+  } else {
+    llvm::raw_ostream *output;
+    auto outputFile = openOutput(output);
+    if (!output)
+      return 1;
+
+    FindingWriter writer(*output);
+    writer.write(merged);
+    writer.finish();
+  }
+
+  Statistics total;
+  if (!writeFixes(fixes, total))
+    failed = true;
+
+  return failed ? 1 : 0;
+}
+
+/*
+ * unlock subcommand
+ *
+ * Reads an -index-dir and ranks the functions that could be constexpr in the
+ * TU defining them, but are called from other TUs that only see their
+ * declaration. For each of them it counts the functions that were rejected
+ * only because of calls to non-constexpr functions, all of which would be
+ * constexpr once it is, directly or through other functions it unlocks. With
+ * -classes it ranks classes instead, by the functions that would follow if
+ * every member of the class that isn't constexpr was.
+ */
+int unlock() {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(UnlockIndexOption, ec), end;
+       !ec && it != end; it.increment(ec))
+    if (llvm::sys::path::extension(it->path()) == ".cxidx")
+      paths.push_back(it->path());
+  if (ec) {
+    llvm::errs() << "constexpr-everything: can't read " << UnlockIndexOption
+                 << ": " << ec.message() << "\n";
+    return 1;
+  }
+  std::sort(paths.begin(), paths.end());
+
+  bool failed = false;
+  std::vector<IndexedFunction> functions;
+  for (const auto &path : paths) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer || !readIndexFile((*buffer)->getBuffer(), functions)) {
+      llvm::errs() << "constexpr-everything: can't read " << path << "\n";
+      failed = true;
+    }
+  }
+
+  // Functions from headers are recorded by every TU that includes them, all
+  // alike, so the first record of each is kept
+  llvm::StringMap<unsigned> byUSR;
+  std::vector<const IndexedFunction *> records;
+  for (const auto &function : functions)
+    if (byUSR.try_emplace(function.USR, records.size()).second)
+      records.push_back(&function);
+
+  // What keeps each blocked function from being constexpr, and the other
+  // way around
+  std::vector<unsigned> blockers(records.size(), 0);
+  llvm::StringMap<std::vector<unsigned>> blocking;
+  llvm::StringSet<> calledWithoutDefinition;
+  for (unsigned i = 0; i < records.size(); ++i) {
+    const auto &record = *records[i];
+    const bool blocked = !(record.Flags & IndexedFunction::Constexpr) &&
+                         (record.Flags & IndexedFunction::BlockedByCalls);
+    for (const auto &callee : record.Callees) {
+      if (!(callee.Flags & IndexedFunction::Callee::Defined))
+        calledWithoutDefinition.insert(callee.USR);
+      if (blocked && !(callee.Flags & IndexedFunction::Callee::Constexpr)) {
+        ++blockers[i];
+        blocking[callee.USR].push_back(i);
+      }
+    }
+  }
+
+  // How many functions become constexpr once the seeds are, not counting
+  // the seeds themselves
+  auto countUnlocked = [&](const std::vector<llvm::StringRef> &seeds) {
+    auto remaining = blockers;
+    llvm::StringSet<> unlocked;
+    for (auto seed : seeds)
+      unlocked.insert(seed);
+    std::deque<llvm::StringRef> worklist(seeds.begin(), seeds.end());
+    unsigned count = 0;
+    while (!worklist.empty()) {
+      auto it = blocking.find(worklist.front());
+      worklist.pop_front();
+      if (it == blocking.end())
+        continue;
+
+      for (auto caller : it->second) {
+        if (--remaining[caller] != 0 ||
+            !unlocked.insert(records[caller]->USR).second)
+          continue;
+        ++count;
+        worklist.push_back(records[caller]->USR);
+      }
+    }
+    return count;
+  };
+
+  struct Ranked {
+    llvm::StringRef Name;
+    llvm::StringRef File;
+    unsigned Line;
+    unsigned Unlocked;
+  };
+  std::vector<Ranked> ranking;
+  if (ClassesOption) {
+    // Each class is listed at its first member in the index
+    struct Class {
+      const IndexedFunction *First = nullptr;
+      std::vector<llvm::StringRef> Members;
+    };
+    llvm::StringMap<Class> classes;
+    for (const auto *record : records) {
+      if (record->Record.empty() ||
+          (record->Flags & IndexedFunction::Constexpr))
+        continue;
+
+      auto &entry = classes[record->Record];
+      if (!entry.First || std::tie(record->File, record->Line) <
+                              std::tie(entry.First->File, entry.First->Line))
+        entry.First = record;
+      entry.Members.push_back(record->USR);
+    }
+
+    for (const auto &entry : classes) {
+      const auto &members = entry.getValue();
+      if (auto count = countUnlocked(members.Members))
+        ranking.push_back({members.First->RecordName, members.First->File,
+                           members.First->Line, count});
+    }
+  } else {
+    for (const auto *record : records) {
+      if (!(record->Flags & IndexedFunction::Constexpr) ||
+          !(record->Flags & IndexedFunction::InMainFile) ||
+          !calledWithoutDefinition.count(record->USR))
+        continue;
+
+      if (auto count = countUnlocked({record->USR}))
+        ranking.push_back({record->Name, record->File, record->Line, count});
+    }
+  }
+
+  // Most unlocked first, then by name
+  std::sort(ranking.begin(), ranking.end(),
+            [](const Ranked &a, const Ranked &b) {
+              if (a.Unlocked != b.Unlocked)
+                return a.Unlocked > b.Unlocked;
+              return a.Name < b.Name;
+            });
+  if (UnlockTopOption != 0 && ranking.size() > UnlockTopOption)
+    ranking.resize(UnlockTopOption);
+
+  for (const auto &ranked : ranking)
+    llvm::outs() << ranked.File << ":" << ranked.Line << ": " << ranked.Name
+                 << " would make " << ranked.Unlocked << " function"
+                 << (ranked.Unlocked == 1 ? "" : "s") << " constexpr if "
+                 << (ClassesOption ? "its members were" : "it were inline")
+                 << "\n";
+
+  return failed ? 1 : 0;
+}
+
+/*
+ * CandidateServer
+ *
+ * -server answers requests on stdin, one JSON object per line:
+ *
+ *   {"id": 1, "file": "src/foo.cpp", "contents": "..."}
+ *
+ * with one line per response on stdout, holding the request's id and either
+ * the file's findings in the -output-format=jsonl shape or an error. The
+ * optional contents replace the file on disk, e.g. for an unsaved editor
+ * buffer. The compilation database is loaded once and every file is kept as
+ * an ASTUnit with a precompiled preamble, so a request only reparses what
+ * follows the file's includes, like clangd does. The least recently used
+ * units are dropped beyond -server-units.
+ */
+class CandidateServer {
+public:
+  CandidateServer(const CompilationDatabase &compilations, const char *argv0)
+      : compilations_(compilations),
+        pchOperations_(std::make_shared<PCHContainerOperations>()) {
+    resourceDir_ = resourceDirectory(argv0);
+  }
+
+  llvm::json::Object handle(const llvm::json::Object &request) {
+    llvm::json::Object response;
+    if (const auto *id = request.get("id"))
+      response["id"] = *id;
+
+    auto file = request.getString("file");
+    if (!file) {
+      response["error"] = "request without a file";
+      return response;
+    }
+
+    TranslationUnitResult result;
+    unsigned errors = 0;
+    std::string error;
+    auto contents = request.getString("contents");
+    if (!analyze(*file, contents ? &*contents : nullptr, result, errors,
+                 error)) {
+      response["error"] = error;
+      return response;
+    }
+
+    llvm::json::Array findings;
+    for (const auto &finding : result.Findings)
+      findings.push_back(findingToJSON(
+          finding, makeAbsolutePath(result.Directory, finding.File)));
+    response["findings"] = std::move(findings);
+    response["errors"] = errors;
+    return response;
+  }
+
+private:
+  struct Unit {
+    std::string File;
+    std::vector<std::string> Arguments;
+    std::unique_ptr<clang::ASTUnit> AST;
+  };
+
+  const CompilationDatabase &compilations_;
+  std::shared_ptr<PCHContainerOperations> pchOperations_;
+  std::string resourceDir_;
+  // Most recently used first
+  std::list<Unit> units_;
+
+  std::vector<std::string> arguments(const CompileCommand &command) const {
+    auto adjuster = combineAdjusters(
+        combineAdjusters(getClangStripOutputAdjuster(),
+                         getClangSyntaxOnlyAdjuster()),
+        combineAdjusters(getClangStripDependencyFileAdjuster(),
+                         getInsertArgumentAdjuster(
+                             ("-resource-dir=" + resourceDir_).c_str(),
+                             ArgumentInsertPosition::BEGIN)));
+    return adjuster(command.CommandLine, command.Filename);
+  }
+
+  Unit &findUnit(const std::string &file) {
+    auto it = llvm::find_if(
+        units_, [&file](const Unit &unit) { return unit.File == file; });
+    if (it != units_.end()) {
+      units_.splice(units_.begin(), units_, it);
+    } else {
+      units_.emplace_front();
+      units_.front().File = file;
+      while (units_.size() > std::max(1u, ServerUnitsOption.getValue()))
+        units_.pop_back();
+    }
+    return units_.front();
+  }
+
+  // Without contents, the file is read from disk
+  bool analyze(llvm::StringRef path, const llvm::StringRef *contents,
+               TranslationUnitResult &result, unsigned &errors,
+               std::string &error) {
+    auto commands = compilations_.getCompileCommands(path);
+    if (commands.empty()) {
+      error = "no compile command for " + path.str();
+      return false;
+    }
+
+    const auto &command = commands.front();
+    result.Directory = command.Directory;
+    auto file = makeAbsolutePath(command.Directory, command.Filename);
+    auto args = arguments(command);
+    auto &unit = findUnit(file);
+
+    // The ASTUnit takes ownership of remapped buffers
+    std::vector<clang::ASTUnit::RemappedFile> remapped;
+    if (contents)
+      remapped.emplace_back(file, llvm::MemoryBuffer::getMemBufferCopy(
+                                      *contents, file)
+                                      .release());
+
+    if (!unit.AST || unit.Arguments != args) {
+      unit.AST = load(command, args, remapped);
+      unit.Arguments = std::move(args);
+    } else if (unit.AST->Reparse(pchOperations_, remapped)) {
+      unit.AST.reset();
+    }
+
+    if (!unit.AST) {
+      error = "can't parse " + file;
+      return false;
+    }
+
+    for (auto it = unit.AST->stored_diag_begin(),
+              end = unit.AST->stored_diag_end();
+         it != end; ++it)
+      if (it->getLevel() >= clang::DiagnosticsEngine::Error)
+        ++errors;
+
+    // Headers may have changed since the last request
+    candidateCache().clear();
+    analyzeTranslationUnit(unit.AST->getSema(), result.Stats, result.Findings,
+                           /*index=*/nullptr);
+    return true;
+  }
+
+  std::unique_ptr<clang::ASTUnit>
+  load(const CompileCommand &command, const std::vector<std::string> &args,
+       std::vector<clang::ASTUnit::RemappedFile> &remapped) {
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs =
+        llvm::vfs::createPhysicalFileSystem().release();
+    fs->setCurrentWorkingDirectory(command.Directory);
+
+    std::vector<const char *> argv;
+    for (const auto &arg : args)
+      argv.push_back(arg.c_str());
+
+    auto diagnostics = clang::CompilerInstance::createDiagnostics(
+        new clang::DiagnosticOptions(), new clang::IgnoringDiagConsumer());
+    std::shared_ptr<clang::CompilerInvocation> invocation =
+        compat::createInvocation(argv, diagnostics, fs);
+    if (!invocation) {
+      for (auto &file : remapped)
+        delete file.second;
+      return nullptr;
+    }
+
+    for (auto &file : remapped)
+      invocation->getPreprocessorOpts().addRemappedFile(file.first,
+                                                        file.second);
+
+    llvm::IntrusiveRefCntPtr<clang::FileManager> files(
+        new clang::FileManager(clang::FileSystemOptions(), fs));
+    return clang::ASTUnit::LoadFromCompilerInvocation(
+        invocation, pchOperations_, diagnostics, files.get(),
+        /*OnlyLocalDecls=*/false,
+        compat::CaptureAllDiagnostics,
+        /*PrecompilePreambleAfterNParses=*/1, clang::TU_Complete,
+        /*CacheCodeCompletionResults=*/false,
+        /*IncludeBriefCommentsInCodeCompletion=*/false,
+        /*UserFilesAreVolatile=*/true);
   }
 };
 
+int serve(const CompilationDatabase &compilations,
+          const std::vector<std::string> &sources, const char *argv0) {
+  CandidateServer server(compilations, argv0);
+  for (const auto &source : sources)
+    server.handle(llvm::json::Object{{"file", source}});
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (llvm::StringRef(line).trim().empty())
+      continue;
+
+    llvm::json::Object response;
+    auto request = llvm::json::parse(line);
+    if (!request) {
+      response["error"] = llvm::toString(request.takeError());
+    } else if (const auto *object = request->getAsObject()) {
+      response = server.handle(*object);
+    } else {
+      response["error"] = "request isn't an object";
+    }
+
+    llvm::outs() << llvm::json::Value(std::move(response)) << "\n";
+    llvm::outs().flush();
+  }
+  return 0;
+}
+} // namespace
+
 int main(int argc, const char **argv) {
-  CommonOptionsParser OptionsParser(argc, argv, ConstexprCategory);
+  // The subcommands work on the outputs of earlier runs and don't need a
+  // compilation database
+  if (argc > 1 && (llvm::StringRef(argv[1]) == "merge" ||
+                   llvm::StringRef(argv[1]) == "unlock")) {
+    llvm::cl::HideUnrelatedOptions(ConstexprCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv);
+    return MergeCommand ? merge() : unlock();
+  }
+
+  auto ParsedOptions =
+      compat::createOptionsParser(argc, argv, ConstexprCategory);
+  if (!ParsedOptions) {
+    llvm::errs() << "constexpr-everything: "
+                 << llvm::toString(ParsedOptions.takeError()) << "\n";
+    return 1;
+  }
+  CommonOptionsParser &OptionsParser = **ParsedOptions;
+
+  for (const auto &dir :
+       std::initializer_list<std::string>{CacheDirOption, ASTDirOption,
+                                          IndexDirOption}) {
+    if (dir.empty())
+      continue;
+
+    if (auto ec = llvm::sys::fs::create_directories(dir)) {
+      llvm::errs() << "constexpr-everything: can't create " << dir << ": "
+                   << ec.message() << "\n";
+      return 1;
+    }
+  }
+
+  const auto &compilations = OptionsParser.getCompilations();
+  auto sources = OptionsParser.getSourcePathList();
+
+  if (InterpOption != Interpreter::Classic &&
+      !compat::HasBytecodeInterpreter) {
+    llvm::errs() << "constexpr-everything: can't use the bytecode "
+                    "interpreter, it was added in LLVM 10\n";
+    return 1;
+  }
+
+  if (ServerOption)
+    return serve(compilations, sources, argv[0]);
+
+  if (!ShardOption.empty()) {
+    unsigned index, count;
+    if (!parseShard(ShardOption, index, count)) {
+      llvm::errs() << "constexpr-everything: -shard expects K/N with "
+                      "1 <= K <= N, got "
+                   << ShardOption << "\n";
+      return 1;
+    }
+    sources = selectShard(sources, index, count);
+  }
+
+  ProfileWeights weights;
+  if (!ProfileOption.empty() && !loadProfile(ProfileOption, weights)) {
+    llvm::errs() << "constexpr-everything: can't read profile "
+                 << ProfileOption << "\n";
+    return 1;
+  }
+
+  llvm::raw_ostream *output;
+  auto outputFile = openOutput(output);
+  if (!output)
+    return 1;
+
+  // Every finding of the run, heaviest first
+  auto rankRun = [&](const std::vector<TranslationUnitResult> &all,
+                     const TranslationUnitResult &templates) {
+    TranslationUnitResult ranked;
+    for (const auto &result : all) {
+      for (const auto &finding : result.Findings) {
+        ranked.Findings.push_back(finding);
+        ranked.Findings.back().File =
+            makeAbsolutePath(result.Directory, finding.File);
+        // The ranking is the order of every finding
+        ranked.Findings.back().Shared = false;
+      }
+    }
+    ranked.Findings.insert(ranked.Findings.end(), templates.Findings.begin(),
+                           templates.Findings.end());
+    rankFindings(ranked.Findings);
+    return ranked;
+  };
+
+  // Templates can only be decided once every TU is done
+  auto decideRunTemplates = [&](const std::vector<TranslationUnitResult> &all) {
+    std::vector<Finding> instantiations;
+    for (const auto &result : all) {
+      for (const auto &finding : result.Findings) {
+        if (finding.kind != Finding::Instantiation)
+          continue;
+        instantiations.push_back(finding);
+        instantiations.back().File =
+            makeAbsolutePath(result.Directory, finding.File);
+      }
+    }
+    return decideTemplates(instantiations);
+  };
+
+  // Which TU claims a shared candidate depends on timing, so they're written
+  // once every TU is done, in position order
+  auto collectShared = [&](const std::vector<TranslationUnitResult> &all) {
+    TranslationUnitResult shared;
+    for (const auto &result : all) {
+      for (const auto &finding : result.Findings) {
+        if (!finding.Shared)
+          continue;
+        shared.Findings.push_back(finding);
+        shared.Findings.back().File =
+            makeAbsolutePath(result.Directory, finding.File);
+      }
+    }
+    std::sort(shared.Findings.begin(), shared.Findings.end(), findingBefore);
+
+    // A TU replayed from the cache repeats what it claimed when it was
+    // stored, which a TU analyzed this run may have claimed again
+    auto same = [](const Finding &a, const Finding &b) {
+      return std::tie(a.File, a.Offset, a.kind) ==
+             std::tie(b.File, b.Offset, b.kind);
+    };
+    shared.Findings.erase(std::unique(shared.Findings.begin(),
+                                      shared.Findings.end(), same),
+                          shared.Findings.end());
+    return shared;
+  };
+
+  const auto runStart = std::chrono::steady_clock::now();
+  Statistics::traceStart() = runStart;
+  std::vector<TranslationUnitResult> results(sources.size());
+  TranslationUnitResult templates;
+  {
+    MemoryScheduler scheduler(uint64_t(MaxMemoryOption) << 20);
+    llvm::ThreadPool pool(compat::threadPoolStrategy(JobsOption));
+    std::vector<std::shared_future<void>> done;
+    done.reserve(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i)
+      done.push_back(pool.async([&, i] {
+        auto ticket = scheduler.admit();
+        processTranslationUnit(compilations, sources[i], results[i]);
+        scheduler.release(ticket);
+        annotateWeights(results[i].Findings, weights);
+      }));
+
+    // Stream findings in source list order while later TUs are still running.
+    // Ranked findings can only be written once all of them are in.
+    if (OutputFormatOption != OutputFormat::Text) {
+      FindingWriter writer(*output);
+      if (ProfileOption.empty()) {
+        for (size_t i = 0; i < sources.size(); ++i) {
+          done[i].wait();
+          writer.write(results[i]);
+        }
+        writer.write(collectShared(results), /*shared=*/true);
+        templates.Findings = decideRunTemplates(results);
+        writer.write(templates);
+      } else {
+        pool.wait();
+        templates.Findings = decideRunTemplates(results);
+        writer.write(rankRun(results, templates));
+      }
+      writer.finish();
+    }
+    pool.wait();
+  }
+
+  // Merge in source list order, dropping fix-its that several TUs produced
+  // for the same header.
+  bool failed = false;
+  FixMap fixes;
+  for (const auto &result : results) {
+    llvm::errs() << result.Diagnostics;
+    failed |= result.Failed;
+
+    for (const auto &replacement : result.Replacements) {
+      auto path = makeAbsolutePath(result.Directory, replacement.getFilePath());
+      fixes[path].emplace(path, replacement.getOffset(),
+                          replacement.getLength(),
+                          replacement.getReplacementText());
+    }
+
+    // Without text output there are no diagnostics to carry the fix-its
+    for (const auto &finding : result.Findings)
+      addFinding(result.Directory, finding, fixes);
+  }
+
+  if (OutputFormatOption == OutputFormat::Text) {
+    for (const auto &finding : collectShared(results).Findings)
+      printFinding(finding);
+    templates.Findings = decideRunTemplates(results);
+    for (const auto &finding : templates.Findings)
+      printFinding(finding);
+    if (!ProfileOption.empty())
+      printRanking(rankRun(results, templates).Findings);
+  }
+  for (const auto &finding : templates.Findings)
+    addFinding("", finding, fixes);
+
+  // Against the sources as they are, before -fix rewrites them
+  if (ImpactOption != 0 &&
+      !estimateImpact(compilations, sources, results, fixes, argv[0]))
+    failed = true;
+
+  Statistics total;
+  if (!writeFixes(fixes, total))
+    failed = true;
+
+  if (!TimeTraceOption.empty() &&
+      !writeTimeTrace(TimeTraceOption, results, total)) {
+    llvm::errs() << "constexpr-everything: can't write " << TimeTraceOption
+                 << "\n";
+    failed = true;
+  }
+
+  if (StatsOption || !StatsJSONOption.empty()) {
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (StatsOption)
+        results[i].Stats.print(llvm::errs(), sources[i]);
+      total.add(results[i].Stats);
+    }
+    if (StatsOption)
+      total.print(llvm::errs(), "total");
+  }
+
+  const std::chrono::duration<double> runWall =
+      std::chrono::steady_clock::now() - runStart;
+  if (!StatsJSONOption.empty() &&
+      !writeStatsJSON(StatsJSONOption, results, total, runWall.count())) {
+    llvm::errs() << "constexpr-everything: can't write " << StatsJSONOption
+                 << "\n";
+    failed = true;
+  }
 
-  ClangTool Tool(OptionsParser.getCompilations(),
-                 OptionsParser.getSourcePathList());
-  Tool.run(newFrontendActionFactory<FunctionDeclFrontendAction>().get());
+  return failed ? 1 : 0;
 }
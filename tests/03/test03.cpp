@@ -0,0 +1,34 @@
+#include <iostream>
+
+// total() and part() each call a member defined after them, so checking in
+// source order finds base() on the first run, part() on the second,
+// total() on the third and twiceTotal() on the fourth. A single run is
+// expected to warn on each line marked below, and on nothing else.
+
+struct Table {
+    int total() const { return part() + part(); } // warning: function can be constexpr
+
+    int part() const { return base() * 2; } // warning: function can be constexpr
+
+    int base() const { return 21; } // warning: function can be constexpr
+
+    int counted() const { // no warning, it changes the counter
+        ++calls;
+        return base();
+    }
+
+    static int calls;
+};
+
+int Table::calls = 0;
+
+// Comes after its callee, but only qualifies once total() does
+int twiceTotal() { return Table().total() * 2; } // warning: function can be constexpr
+
+int main() {
+    const int total = Table().total(); // warning: variable can be constexpr
+    const int counted = Table().counted(); // no warning
+
+    std::cout << total << " " << counted << " " << twiceTotal() << "\n";
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+// constexpr is a decl-specifier, so a statement declaring several variables
+// gets one fix-it at its start when every declarator qualifies, and none when
+// one of them doesn't. Structured bindings can't be constexpr at all. The
+// expected warnings are marked on their lines, nothing else is reported.
+
+const int rows = 4, cols = rows * 2; // warning: variable can be constexpr
+
+const int seed = 1, noise = std::rand(); // no warning, noise isn't constant
+
+const auto [width, height] = std::make_pair(640, 480); // no warning
+
+int main(int argc, char **argv) {
+    const int a = 1, b = 2; // warning: variable can be constexpr
+    // -fix writes: constexpr const int a = 1, b = 2;
+
+    const int c = 3, d = argc; // no warning, d isn't constant
+
+    const auto [x, y] = std::make_pair(a, b); // no warning
+
+    std::cout << rows * cols << " " << seed + noise << " " << width * height
+              << "\n";
+    std::cout << a + b << " " << c + d << " " << x + y << " " << argv[0]
+              << "\n";
+    return 0;
+}
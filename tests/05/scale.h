@@ -0,0 +1,8 @@
+#ifndef TEST05_SCALE_H
+#define TEST05_SCALE_H
+
+// Whether an instantiation can be constexpr depends on the TU: only
+// test05.cpp defines factor(), test05_other.cpp only declares it
+template <typename T> T scale(T x) { return x * factor(); }
+
+#endif
@@ -0,0 +1,42 @@
+#include <iostream>
+
+// Run with -headers -templates on both TUs. The expected warnings and remarks
+// are marked on their lines, nothing else is reported.
+
+int factor() { return 2; } // warning: function can be constexpr
+
+// scale<int> can be constexpr here but not in test05_other.cpp, so the TUs
+// disagree about it, while scale<long> is only instantiated here:
+//   scale.h: remark: scale is conditionally constexpr, it can be for
+//   scale<long> but not for scale<int>
+// Without test05_other.cpp, scale is a function template that can be
+// constexpr. merge of the two TUs' -output-format=jsonl gives the remark too.
+#include "scale.h"
+
+int other();
+
+// Every instantiation can be constexpr
+template <typename T> T square(T x) { return x * x; } // warning: function template can be constexpr
+
+struct Fixed {
+    constexpr int get() const { return 4; }
+};
+
+struct Dynamic {
+    int get() const { // no warning, it has a static local
+        static int calls = 0;
+        return ++calls;
+    }
+};
+
+// Only some instantiations can be constexpr
+// remark: twiceOf is conditionally constexpr, it can be for twiceOf<Fixed> but
+// not for twiceOf<Dynamic>
+template <typename T> int twiceOf(const T &t) { return t.get() * 2; }
+
+int main() {
+    std::cout << scale(3) << " " << scale(4L) << " " << other() << "\n";
+    std::cout << square(3) << " " << square(2.5) << "\n";
+    std::cout << twiceOf(Fixed()) << " " << twiceOf(Dynamic()) << "\n";
+    return 0;
+}
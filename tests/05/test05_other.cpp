@@ -0,0 +1,6 @@
+int factor();
+
+#include "scale.h"
+
+// No warning, scale<int> can't be constexpr in this TU
+int other() { return scale(5); }